@@ -0,0 +1,159 @@
+#include <pebble.h>
+#include "heap_budget.h"
+
+//----------LOCAL VALUE DEFINITIONS----------
+//#define HEAP_BUDGET_DEBUG_ENABLED//comment out to disable budget debug logs
+#ifdef HEAP_BUDGET_DEBUG_ENABLED
+#define BUDGET_DEBUG(fmt, ...) APP_LOG(APP_LOG_LEVEL_DEBUG,fmt,##__VA_ARGS__);
+#else
+#define BUDGET_DEBUG(fmt, args...)
+#endif
+
+#define HEAP_RESERVE PBL_IF_COLOR_ELSE(4000,2000)
+//Bytes always left free for windows, menus and the system, which
+//allocate without going through the budget
+
+#define LOW_BUDGET_PERCENT 75
+//A client is low on memory once it has used this much of its quota
+
+//Budget state for one client
+typedef struct{
+  uint8_t share;//percent of the budgeted heap given to the client
+  size_t quota;//most bytes the client should hold
+  size_t used;//bytes the client currently holds
+  BudgetEvictHandler evict;//frees client memory, or NULL
+}Budget;
+
+//----------LOCAL VARIABLES----------
+//Subpages get most of the heap, page titles only need to cover a
+//screen or two of the list
+static Budget budgets[NUM_BUDGET_CLIENTS] = {
+  [BUDGET_TITLES] = {.share = 15},
+  [BUDGET_SUBPAGES] = {.share = 60},
+  [BUDGET_MESSAGES] = {.share = 25}
+};
+
+//----------STATIC FUNCTION DECLARATIONS----------
+static size_t heap_shortfall(size_t bytes);
+  //Gets how many bytes must be freed before an allocation leaves the reserve intact
+static void evict_client(BudgetClient client, size_t bytes);
+  //Asks a client to free memory
+
+//----------PUBLIC FUNCTIONS----------
+/**
+*Measures the free heap and assigns each client its quota.  This
+*must run before any client allocates memory.
+*/
+void budget_init(){
+  size_t heapFree = heap_bytes_free();
+  size_t budgeted = heapFree > HEAP_RESERVE ? heapFree - HEAP_RESERVE : 0;
+  for(int i = 0; i < NUM_BUDGET_CLIENTS; i++){
+    budgets[i].quota = budgeted * budgets[i].share / 100;
+    BUDGET_DEBUG("budget_init:client %d quota %d bytes",i,(int) budgets[i].quota);
+  }
+}
+
+/**
+*Sets the function that frees a client's memory under pressure
+*@param client the budget client
+*@param evict the client's eviction handler, or NULL if it can't
+*free memory on request
+*/
+void budget_register(BudgetClient client, BudgetEvictHandler evict){
+  budgets[client].evict = evict;
+}
+
+/**
+*Reserves memory for a client, evicting memory from this or other
+*clients first if the client is over quota or the heap is low
+*@param client the budget client
+*@param bytes the number of bytes the client is about to allocate
+*@return true if the memory was reserved, false if there isn't room
+*even after eviction
+*/
+bool budget_reserve(BudgetClient client, size_t bytes){
+  Budget * budget = &budgets[client];
+  //stay inside the client's own quota first
+  if(budget->used + bytes > budget->quota)
+    evict_client(client, budget->used + bytes - budget->quota);
+  //then free memory in eviction order until the heap reserve is safe
+  for(int i = 0; i < NUM_BUDGET_CLIENTS && heap_shortfall(bytes) > 0; i++)
+    evict_client((BudgetClient) i, heap_shortfall(bytes));
+  if(budget->used + bytes > budget->quota || heap_shortfall(bytes) > 0){
+    BUDGET_DEBUG("budget_reserve:client %d refused %d bytes, using %d/%d, %d free",
+                 client,(int) bytes,(int) budget->used,(int) budget->quota,
+                 (int) heap_bytes_free());
+    return false;
+  }
+  budget->used += bytes;
+  return true;
+}
+
+/**
+*Counts memory a client allocated without asking, like memory it
+*can't work without
+*@param client the budget client
+*@param bytes the number of bytes allocated
+*/
+void budget_charge(BudgetClient client, size_t bytes){
+  budgets[client].used += bytes;
+}
+
+/**
+*Returns reserved or charged memory after the client frees it
+*@param client the budget client
+*@param bytes the number of bytes freed
+*/
+void budget_release(BudgetClient client, size_t bytes){
+  Budget * budget = &budgets[client];
+  budget->used = bytes < budget->used ? budget->used - bytes : 0;
+}
+
+/**
+*Gets a client's byte quota
+*@param client the budget client
+*@return the quota in bytes, or 0 before budget_init runs
+*/
+size_t budget_get_quota(BudgetClient client){
+  return budgets[client].quota;
+}
+
+/**
+*Checks if a client has used most of its quota, or if the heap is
+*close to running out
+*@param client the budget client
+*@return true if the client should avoid allocating memory it
+*doesn't need yet
+*/
+bool budget_is_low(BudgetClient client){
+  Budget * budget = &budgets[client];
+  return budget->used * 100 >= budget->quota * LOW_BUDGET_PERCENT ||
+         heap_bytes_free() < 2 * HEAP_RESERVE;
+}
+
+//----------STATIC FUNCTIONS----------
+/**
+*Gets how many bytes must be freed before an allocation leaves the
+*heap reserve intact
+*@param bytes the size of the allocation
+*@return the missing bytes, or 0 if the allocation fits
+*/
+static size_t heap_shortfall(size_t bytes){
+  size_t needed = bytes + HEAP_RESERVE;
+  size_t heapFree = heap_bytes_free();
+  return heapFree >= needed ? 0 : needed - heapFree;
+}
+
+/**
+*Asks a client to free memory, if it holds any and can free it
+*@param client the budget client
+*@param bytes the number of bytes needed
+*/
+static void evict_client(BudgetClient client, size_t bytes){
+  Budget * budget = &budgets[client];
+  if(budget->evict == NULL || budget->used == 0) return;
+  size_t released = budget->evict(bytes);
+  BUDGET_DEBUG("evict_client:client %d released %d of %d bytes",
+               client,(int) released,(int) bytes);
+  (void) released;
+}
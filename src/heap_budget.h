@@ -0,0 +1,85 @@
+#pragma once
+/**
+*@File heap_budget.h
+*Shares the app heap between the subsystems that hold large or
+*growing amounts of memory.  Each client gets a byte quota sized from
+*the heap available at startup, and when a client goes over its quota
+*or the heap runs low, clients are asked to free memory in eviction
+*order, lowest priority first.
+*/
+#include <pebble.h>
+
+//Subsystems with heap budgets, in eviction order
+typedef enum{
+  BUDGET_TITLES,
+    //page titles in the page list, freed first while reading
+  BUDGET_SUBPAGES,
+    //loaded article text and text layers
+  BUDGET_MESSAGES,
+    //AppMessage buffers, charged once and never evicted
+  NUM_BUDGET_CLIENTS
+}BudgetClient;
+
+/**
+*Frees some of a client's memory when asked by the budget manager.
+*Freed memory must be given back with budget_release.
+*@param bytes the number of bytes the budget manager needs
+*@return the number of bytes released, which may be more or less than
+*requested
+*/
+typedef size_t (*BudgetEvictHandler)(size_t bytes);
+
+/**
+*Measures the free heap and assigns each client its quota.  This
+*must run before any client allocates memory.
+*/
+void budget_init();
+
+/**
+*Sets the function that frees a client's memory under pressure
+*@param client the budget client
+*@param evict the client's eviction handler, or NULL if it can't
+*free memory on request
+*/
+void budget_register(BudgetClient client, BudgetEvictHandler evict);
+
+/**
+*Reserves memory for a client, evicting memory from this or other
+*clients first if the client is over quota or the heap is low
+*@param client the budget client
+*@param bytes the number of bytes the client is about to allocate
+*@return true if the memory was reserved, false if there isn't room
+*even after eviction
+*/
+bool budget_reserve(BudgetClient client, size_t bytes);
+
+/**
+*Counts memory a client allocated without asking, like memory it
+*can't work without
+*@param client the budget client
+*@param bytes the number of bytes allocated
+*/
+void budget_charge(BudgetClient client, size_t bytes);
+
+/**
+*Returns reserved or charged memory after the client frees it
+*@param client the budget client
+*@param bytes the number of bytes freed
+*/
+void budget_release(BudgetClient client, size_t bytes);
+
+/**
+*Gets a client's byte quota
+*@param client the budget client
+*@return the quota in bytes, or 0 before budget_init runs
+*/
+size_t budget_get_quota(BudgetClient client);
+
+/**
+*Checks if a client has used most of its quota, or if the heap is
+*close to running out
+*@param client the budget client
+*@return true if the client should avoid allocating memory it
+*doesn't need yet
+*/
+bool budget_is_low(BudgetClient client);
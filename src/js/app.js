@@ -11,7 +11,8 @@ var JS_MESSAGE_CODES = {sendingPageTitles:0,
                         JSInitialized:2,
                         resetPageData:3,
                         opSucceeded:4,
-                        opFailed:5};
+                        opFailed:5,
+                        protocolConfig:6};
 var PEBBLE_MESSAGE_CODES = {requestingPageTitles:0,
                             loadPage:1,
                             getPageText:2,
@@ -21,7 +22,14 @@ var PEBBLE_MESSAGE_CODES = {requestingPageTitles:0,
                             clearLocalStorage:6,
                             updateTitles:7,
                             bookmarkPage:8,
-                            removeBookmark:9};
+                            removeBookmark:9,
+                            cancelRequests:10,
+                            capabilities:11,
+                            streamCredits:12};
+
+//Request types pebble may cancel, sent as content_type
+var REQUEST_TYPES = {pageTitles:0,
+                     pageText:1};
 
 var OPCODES = {login:0,
                loadPages:1,
@@ -36,6 +44,57 @@ var FAVE_STATUS_VALUES = [0,1,null];
 
 var SORT_ORDER_VALUES = ["newest","oldest","title","site"];
 
+//Binary frame format version, see message_handler.c on the watch
+var FRAME_VERSION = 1;
+
+//Newest handshake protocol version this script understands
+var PROTOCOL_VERSION = 1;
+
+//Optional protocol features the watch may support
+var FEATURES = {compressedText:1,
+                textStreaming:2};
+
+//Time in ms before retrying a pushed subpage pebble didn't acknowledge
+var STREAM_RETRY_DELAY = 1000;
+
+//Watch capabilities, replaced when the watch sends its own
+var watchCapabilities = {protocolVersion:0,
+                         platform:"unknown",
+                         inboxSize:2048,
+                         freeHeap:0,
+                         features:FEATURES.compressedText};
+
+//Subpage size limits, in characters
+var SUBPAGE_SIZE = {fallback:400,//used before the handshake
+                    min:400,
+                    max:1500};
+var FRAME_OVERHEAD = 32;//dictionary, frame header and section bytes around subpage text
+var MAX_UTF8_CHAR_SIZE = 3;//bytes per character in the worst case
+var HEAP_PER_SUBPAGE_CHAR = 16;//free watch memory needed per subpage character
+
+//Binary frame flags
+var FRAME_FLAGS = {compressed:1};//text sections are compressed
+
+//Compressed text tokens, see text_codec.h on the watch
+var COMPRESSION_TOKENS = {dictionary:0x80,
+                          reference:0xC0,
+                          escape:0xFE};
+var MIN_REFERENCE_LENGTH = 3;
+var MAX_REFERENCE_LENGTH = COMPRESSION_TOKENS.escape - COMPRESSION_TOKENS.reference + MIN_REFERENCE_LENGTH - 1;
+var MAX_REFERENCE_DISTANCE = 0x7FFF;
+
+//Static compression dictionary, must match dictionaryWords in text_codec.c
+var COMPRESSION_WORDS = [
+  " the"," and"," of"," to"," in"," a"," is"," that",
+  " for"," it"," was"," on"," with"," as"," be"," at",
+  " by"," this"," have"," from"," or"," are"," not"," but",
+  " an"," they"," which"," you"," we"," his"," her"," their",
+  " has"," been"," one"," all"," will"," more"," can"," would",
+  " there"," about"," what"," when"," so"," if"," were"," said",
+  "ing ","tion","ed ","er ","ly ","ent",". ",", ",
+  " The","ment","ould","ight","ough"," new"," also"," people"
+];
+
 
 //----------PAGE LIST DATA----------
 //PocketConnection connection: handles connecting to pocket API
@@ -100,6 +159,164 @@ function getTimeString(ms){
   return result;
 }
 
+/**
+*Encodes a string as an array of UTF-8 bytes.  Unpaired surrogates are
+*encoded as U+FFFD instead of throwing like encodeURIComponent does.
+*str: the string to encode
+*return: the encoded bytes
+*/
+function utf8Bytes(str){
+  var bytes = [];
+  for(var i = 0; i < str.length; i++){
+    var c = str.charCodeAt(i);
+    if(c >= 0xD800 && c <= 0xDFFF){
+      var next = i + 1 < str.length ? str.charCodeAt(i + 1) : 0;
+      if(c <= 0xDBFF && next >= 0xDC00 && next <= 0xDFFF){
+        c = 0x10000 + ((c - 0xD800) << 10) + (next - 0xDC00);
+        i++;
+      }else c = 0xFFFD;
+    }
+    if(c < 0x80) bytes.push(c);
+    else if(c < 0x800) bytes.push(0xC0 | (c >> 6), 0x80 | (c & 0x3F));
+    else if(c < 0x10000){
+      bytes.push(0xE0 | (c >> 12), 0x80 | ((c >> 6) & 0x3F), 0x80 | (c & 0x3F));
+    }else{
+      bytes.push(0xF0 | (c >> 18), 0x80 | ((c >> 12) & 0x3F),
+                 0x80 | ((c >> 6) & 0x3F), 0x80 | (c & 0x3F));
+    }
+  }
+  return bytes;
+}
+
+/**
+*Builds a binary response frame, sent to pebble as the frame value
+*instead of separate keys for every field.  All values are little-endian.
+*code: the JS_MESSAGE_CODES value
+*fields: optional header values: request_id, index, item_count,
+*page_state, favorite, scroll_offset, and flags
+*sections: strings or byte arrays sent as null-terminated,
+*length-prefixed sections
+*return: the frame as a byte array
+*/
+function buildFrame(code,fields,sections){
+  var frame = [];
+  var pushInt16 = function(value){
+    frame.push(value & 0xFF, (value >> 8) & 0xFF);
+  };
+  frame.push(FRAME_VERSION, code);
+  pushInt16(fields.request_id || 0);
+  pushInt16(fields.index || 0);
+  pushInt16(fields.item_count || 0);
+  frame.push(fields.page_state || 0, fields.favorite || 0);
+  pushInt16(typeof fields.scroll_offset == "number" ? fields.scroll_offset : -1);
+  frame.push(sections.length, fields.flags || 0);
+  for(var i = 0; i < sections.length; i++){
+    var bytes = sections[i];
+    if(typeof bytes == "string") bytes = utf8Bytes(bytes);
+    pushInt16(bytes.length);
+    frame = frame.concat(bytes);
+    frame.push(0);
+  }
+  return frame;
+}
+
+/**
+*Chooses the subpage size for the connected watch.  Subpages must fit in
+*the watch's inbox even if every character needs MAX_UTF8_CHAR_SIZE bytes,
+*and the watch must have enough memory to hold several of them.
+*return: the number of characters to send per subpage
+*/
+function getSubpageSize(){
+  if(!watchCapabilities.protocolVersion) return SUBPAGE_SIZE.fallback;
+  var size = SUBPAGE_SIZE.max;
+  if(watchCapabilities.freeHeap > 0)
+    size = Math.min(size, Math.floor(watchCapabilities.freeHeap / HEAP_PER_SUBPAGE_CHAR));
+  size = Math.max(size, SUBPAGE_SIZE.min);
+  var inboxLimit = Math.floor((watchCapabilities.inboxSize - FRAME_OVERHEAD) / MAX_UTF8_CHAR_SIZE);
+  return Math.min(size, inboxLimit);
+}
+
+/**
+*Records the capabilities the watch reported, and replies with the
+*protocol version and subpage size that will be used
+*payload: the watch's capabilities message
+*/
+function handleCapabilities(payload){
+  watchCapabilities = {protocolVersion:Math.min(payload.protocol_version, PROTOCOL_VERSION),
+                       platform:payload.platform,
+                       inboxSize:payload.inbox_size,
+                       freeHeap:payload.free_heap,
+                       features:payload.features};
+  var pageSize = getSubpageSize();
+  if(debugConnection)console.log("handleCapabilities: "+JSON.stringify(watchCapabilities)+
+                                 ", using subpage size "+pageSize);
+  Pebble.sendAppMessage({'message_code':JS_MESSAGE_CODES.protocolConfig,
+                         'protocol_version':watchCapabilities.protocolVersion,
+                         'page_size':pageSize,
+                         'features':watchCapabilities.features & (FEATURES.compressedText | FEATURES.textStreaming)});
+}
+
+//----------TEXT COMPRESSION----------
+var compressionWordBytes = COMPRESSION_WORDS.map(utf8Bytes);
+
+/**
+*Compresses text in the format decoded by text_codec.c on the watch,
+*using static dictionary words and back-references to earlier text
+*text: the text to compress
+*return: the compressed bytes, or null if compressing doesn't save space
+*/
+function compressText(text){
+  var bytes = utf8Bytes(text);
+  var out = [bytes.length & 0xFF, (bytes.length >> 8) & 0xFF];
+  var pos = 0;
+  while(pos < bytes.length){
+    //find the longest earlier match
+    var refLength = 0;
+    var refDistance = 0;
+    var maxLength = Math.min(MAX_REFERENCE_LENGTH, bytes.length - pos);
+    var minStart = Math.max(0, pos - MAX_REFERENCE_DISTANCE);
+    for(var start = pos - 1; start >= minStart && refLength < maxLength; start--){
+      var length = 0;
+      while(length < maxLength && bytes[start + length] == bytes[pos + length]) length++;
+      if(length > refLength){
+        refLength = length;
+        refDistance = pos - start;
+      }
+    }
+    var refSavings = refLength - (refDistance < 0x80 ? 2 : 3);
+    //find the longest matching dictionary word
+    var word = -1;
+    var wordLength = 0;
+    for(var w = 0; w < compressionWordBytes.length; w++){
+      var wordBytes = compressionWordBytes[w];
+      if(wordBytes.length <= wordLength) continue;
+      var matched = true;
+      for(var c = 0; c < wordBytes.length && matched; c++){
+        matched = bytes[pos + c] == wordBytes[c];
+      }
+      if(matched){
+        word = w;
+        wordLength = wordBytes.length;
+      }
+    }
+    if(refLength >= MIN_REFERENCE_LENGTH && refSavings > 0 && refSavings >= wordLength - 1){
+      out.push(COMPRESSION_TOKENS.reference + refLength - MIN_REFERENCE_LENGTH);
+      if(refDistance < 0x80) out.push(refDistance);
+      else out.push(0x80 | (refDistance >> 8), refDistance & 0xFF);
+      pos += refLength;
+    }else if(word >= 0){
+      out.push(COMPRESSION_TOKENS.dictionary + word);
+      pos += wordLength;
+    }else{
+      if(bytes[pos] >= COMPRESSION_TOKENS.dictionary) out.push(COMPRESSION_TOKENS.escape);
+      out.push(bytes[pos]);
+      pos++;
+    }
+  }
+  if(out.length >= bytes.length) return null;
+  return out;
+}
+
 //----------CONNECTION----------
 //Handles connecting to pocket
 function PocketConnection(pocketKey){
@@ -372,6 +589,7 @@ function PageLists(pageKey,pocketConnection){
   this.archivedPageList = [];
   this.favoritePageList = [];
   this.modifyTime = pocketTime(); //last update time
+  var requestGeneration = 0;//incremented whenever pebble cancels title requests
   
    /**
   *saves list data to local storage
@@ -601,19 +819,25 @@ function PageLists(pageKey,pocketConnection){
   *index: first page to send
   *count: number of pages to send
   *skipLoading: optional boolean signalling to skip loading new pages
+  *requestId: the pebble request ID to send back with the titles
   */
-  this.pagesToPebble = function(index,count,skipLoading){
+  this.pagesToPebble = function(index,count,skipLoading,requestId){
     if(debugPageList)console.log("pagesToPebble: pebble requested pages "+index+"-"+(index+count));
     var pageList = this.getCurrentPageList();
     if(!this.pebbleRequest && pageList.length < index+count && !skipLoading){
       if(debugPageList)console.log("pagesToPebble: list only contains "+pageList.length+" items, loading more");
+      var generation = requestGeneration;
       this.loadNewPages(index,count,function(pageLists){
+          if(generation != requestGeneration){
+            if(debugPageList)console.log("pagesToPebble: request for pages at "+index+" was cancelled");
+            return;
+          }
           console.log("pagesToPebble:callback sending back request for "+count +" pages at "+index);
-          pageLists.pagesToPebble(index,count,true);
+          pageLists.pagesToPebble(index,count,true,requestId);
       },this); 
     }else{//pages found, bundle titles into message
       this.pebbleRequest = null;
-      var titleList = "";
+      var titleList = [];
       var titleNum = 0;
       for(var titleIndex = index; titleIndex < index+count; titleIndex++){
         if(pageList[titleIndex]){
@@ -624,25 +848,36 @@ function PageLists(pageKey,pocketConnection){
           else if(titleItem.given_url) title = titleItem.given_url;
           if(title){
             titleNum++;
-            titleList += title + '\n';
+            titleList.push(title);
             //if(debugPageList)console.log("pagesToPebble: title " + titleIndex+ " is " + titleItem.resolved_title);
           }
         //else if(debugPageList)console.log("pagesToPebble:index "+titleNum+"had no resolved title, value:"+JSON.stringify(titleItem));
         }
       }
-      if(debugPageList)console.log("pagesToPebble: found " +titleNum +  " titles, total length:" + titleList.length);
+      if(debugPageList)console.log("pagesToPebble: found " +titleNum +  " titles");
       if(titleNum > 0){
         var titleMsg = {};
-        titleMsg.message_code = JS_MESSAGE_CODES.sendingPageTitles;
-        titleMsg.message_text = titleList;
-        titleMsg.item_count = titleNum-index;
-        titleMsg.index = index;
+        titleMsg.frame = buildFrame(JS_MESSAGE_CODES.sendingPageTitles,
+                                    {request_id:requestId,
+                                     index:index,
+                                     item_count:titleNum},
+                                    titleList);
         Pebble.sendAppMessage(titleMsg);
         this.save();
       }
     }
   };
   
+  /**
+  *Cancels title requests pebble no longer needs, so
+  *titles still loading aren't sent back
+  */
+  this.cancelRequests = function(){
+    if(debugPageList)console.log("cancelRequests: cancelling title requests");
+    requestGeneration++;
+    this.pebbleRequest = null;
+  };
+  
   /**
   *gets a single page from the selected list
   *index: page index in the list
@@ -680,7 +915,6 @@ function PageLists(pageKey,pocketConnection){
 //Handles page text
 function PageText(textKey,pageLists,pocketConnection){ 
   this.PAGE_SIZE_LIMIT = 4 * 1024 * 1024;//limit: 4MB
-  this.DEFAULT_PAGE_SIZE = 400; //Number of bytes to send at a time
   
   /**
   *saves page data to local storage
@@ -727,6 +961,11 @@ function PageText(textKey,pageLists,pocketConnection){
   };
   
    //Initialize values
+  var pageRequest = null;//page text download in progress, if any
+  var requestGeneration = 0;//incremented whenever pebble cancels page requests
+  //subpages pushed to pebble without requests: pebble's page load request ID,
+  //the next subpage to push, pebble's credit limit, and whether a push is in flight
+  var stream = {id:0, next:0, limit:0, sending:false};
   this.textKey = textKey;
   this.pageLists = pageLists;
   this.pocketConnection = pocketConnection;
@@ -740,24 +979,46 @@ function PageText(textKey,pageLists,pocketConnection){
   /**
   *Loads a new currentPage
   *pageNum: the page to load
+  *requestId: the pebble request ID to send back with the page text
   */
-  this.loadPage = function(pageNum){
-    var onload = function(pageLists,savedPage){
+  this.loadPage = function(pageNum,requestId){
+    var savedPage = this;
+    var generation = requestGeneration;
+    var onload = function(pageLists){
+      if(generation != requestGeneration){
+        if(debugPageText)console.log("loadPage: request for page "+pageNum+" was cancelled");
+        return;
+      }
       var page = pageLists.getPage(pageNum);
       console.log(JSON.stringify(page));
-      if(page) savedPage.initCurrentPage(page,pageNum);
+      if(page) savedPage.initCurrentPage(page,pageNum,requestId);
     };
     if(this.pageLists.getPage(pageNum))
-      onload(this.pageLists,this);
-    else this.pageLists.loadNewPages(pageNum,1,onload,this);
+      onload(this.pageLists);
+    else this.pageLists.loadNewPages(pageNum,1,onload);
+  };
+  
+  /**
+  *Cancels page requests pebble no longer needs, stopping
+  *any page text download in progress
+  */
+  this.cancelRequests = function(){
+    if(debugPageText)console.log("cancelRequests: cancelling page requests");
+    requestGeneration++;
+    stream = {id:0, next:0, limit:0, sending:false};
+    if(pageRequest){
+      pageRequest.abort();
+      pageRequest = null;
+    }
   };
     
   /**
   *Initializes current page data, sending text to pebble
   *page: the new page to load
   *pageNum: page index
+  *requestId: the pebble request ID to send back with the page text
   */
-  this.initCurrentPage = function(page,pageNum){
+  this.initCurrentPage = function(page,pageNum,requestId){
     this.currentPage = {};
     //check to see if the page is saved
     var foundPage = this.getBookmarkedPageIndex(page);
@@ -766,23 +1027,27 @@ function PageText(textKey,pageLists,pocketConnection){
       this.currentPage.page = page;
       if(debugPageText)console.log("initCurrentPage: loaded page "+pageNum+" from saved pages");
       if(debugPageText)console.log("initCurrentPage: bookmark is at subpage "+this.currentPage.subpage+" offset "+this.currentPage.offset);
-      if(this.currentPage.subpage) this.sendText(this.currentPage.subpage);
-      else this.sendText(0);
+      var firstSubpage = this.currentPage.subpage ? this.currentPage.subpage : 0;
+      this.startStream(firstSubpage + 1,requestId);
+      this.sendText(firstSubpage,requestId);
     }
     else if(page.given_url){//otherwise load the page
       if(debugPageText)console.log("initCurrentPage: loading "+page.given_url);
       this.currentPage.page = page;
-      var pageRequest = new XMLHttpRequest();
+      if(pageRequest) pageRequest.abort();
+      pageRequest = new XMLHttpRequest();
       var savedPage = this;
       try{
         pageRequest.open("GET", page.given_url, true);
         pageRequest.onload = function(){
+          pageRequest = null;
           //savedPage.findNextPage(page,this.response);
           savedPage.currentPage.text = savedPage.processPageText(page,this.response + '\n');
           savedPage.currentPage.text = savedPage.textToSubPages(savedPage.currentPage.text);
           savedPage.currentPage.index = pageNum;
           //send first subpage to pebble
-          savedPage.sendText(0);
+          savedPage.startStream(1,requestId);
+          savedPage.sendText(0,requestId);
           if(debugPageText)console.log("initCurrentPage: Getting page "+pageNum);
         };
         pageRequest.send();
@@ -917,7 +1182,7 @@ function PageText(textKey,pageLists,pocketConnection){
   };
   
   /**
-  *Breaks the page text into an array of subpages of DEFAULT_PAGE_SIZE or less
+  *Breaks the page text into an array of subpages no longer than getSubpageSize()
   *pageText:the page to process
   *return: the page as an array of subpages
   */
@@ -926,8 +1191,9 @@ function PageText(textKey,pageLists,pocketConnection){
     var index = 0;
     var pageArray = [];
     var pageNum = 0;
+    var subpageSize = getSubpageSize();
     while(index <= pageText.length){
-      var subPage = pageText.substr(index,this.DEFAULT_PAGE_SIZE);
+      var subPage = pageText.substr(index,subpageSize);
       index += subPage.length;
       if(subPage.length === 0)break;
       if(debugPageText)console.log("Index:"+index);
@@ -938,6 +1204,12 @@ function PageText(textKey,pageLists,pocketConnection){
           index --;
         }
       }
+      //don't split a surrogate pair between two subpages
+      var lastCode = subPage.charCodeAt(subPage.length-1);
+      if(lastCode >= 0xD800 && lastCode <= 0xDBFF && subPage.length > 1){
+        subPage = subPage.substr(0,subPage.length-1);
+        index --;
+      }
       if(debugPageText)console.log("subpage "+pageNum+": "+subPage.length+" chars at index "+index);
       pageNum++;
       pageArray.push(subPage);
@@ -945,11 +1217,57 @@ function PageText(textKey,pageLists,pocketConnection){
     return pageArray;
   };
   
+  /**
+  *Prepares to push subpages after the first one, once pebble grants credits
+  *next: the first subpage to push
+  *requestId: pebble's page load request ID, sent back with pushed subpages
+  */
+  this.startStream = function(next,requestId){
+    stream = {id:requestId, next:next, limit:0, sending:false};
+  };
+
+  /**
+  *Lets this script push subpages to pebble without waiting for requests
+  *limit: pebble accepts pushed subpages with indexes below this
+  *streamId: pebble's page load request ID
+  */
+  this.grantCredits = function(limit,streamId){
+    if(streamId != stream.id) return;
+    if(limit > stream.limit) stream.limit = limit;
+    this.pumpStream();
+  };
+
+  /**
+  *Pushes the next subpage pebble has credit for.  Only one push is
+  *in flight at a time, so a cancelled stream stops quickly.
+  */
+  this.pumpStream = function(){
+    if(stream.sending || !stream.id || stream.next >= stream.limit ||
+       !this.currentPage.text || stream.next >= this.currentPage.text.length) return;
+    var savedPage = this;
+    var id = stream.id;
+    stream.sending = true;
+    if(debugPageText)console.log("pumpStream: pushing subpage "+stream.next+" of "+stream.limit);
+    this.sendText(stream.next,id,function(){
+      if(id != stream.id) return;
+      stream.sending = false;
+      stream.next++;
+      savedPage.pumpStream();
+    },function(){
+      if(id != stream.id) return;
+      stream.sending = false;
+      setTimeout(function(){ savedPage.pumpStream(); },STREAM_RETRY_DELAY);
+    });
+  };
+
   /**
   *Sends the requested subpage to pebble
   *index: index of the subpage to send back to pebble
+  *requestId: the pebble request ID to send back with the text
+  *onSent: optional function to run when pebble receives the text
+  *onFailed: optional function to run if sending fails
   */
-  this.sendText = function(index){
+  this.sendText = function(index,requestId,onSent,onFailed){
     if(this.currentPage.text.length <= index){
       if(debugPageText)console.log("error:requested subpage at "+index+", but pagecount="+this.currentPage.text.length);
       return;
@@ -958,17 +1276,21 @@ function PageText(textKey,pageLists,pocketConnection){
     textBlock = this.currentPage.text[index];
     if(debugPageText)console.log("requested subpage at "+index);
     if(debugPageText)console.log("sending " + textBlock.length +" characters,"+textBlock);
-    var appMsg = {};
-    appMsg.message_code = JS_MESSAGE_CODES.sendingPageText;
-    appMsg.message_text = textBlock;
-    appMsg.index = index;
-    appMsg.item_count = this.currentPage.text.length;
-    appMsg.favorite = parseInt(this.currentPage.page.favorite,10);
-    appMsg.page_state = parseInt(this.currentPage.page.status,10);
+    var fields = {request_id:requestId,
+                  index:index,
+                  item_count:this.currentPage.text.length,
+                  favorite:parseInt(this.currentPage.page.favorite,10),
+                  page_state:parseInt(this.currentPage.page.status,10)};
     if(this.currentPage.subpage == index && 
        this.currentPage.offset !== undefined)
-      appMsg.scroll_offset = this.currentPage.offset;
-    Pebble.sendAppMessage(appMsg);
+      fields.scroll_offset = this.currentPage.offset;
+    var section = null;
+    if(watchCapabilities.features & FEATURES.compressedText) section = compressText(textBlock);
+    if(section !== null) fields.flags = FRAME_FLAGS.compressed;
+    else section = textBlock;
+    var appMsg = {};
+    appMsg.frame = buildFrame(JS_MESSAGE_CODES.sendingPageText,fields,[section]);
+    Pebble.sendAppMessage(appMsg,onSent,onFailed);
     console.log("page_size: "+this.currentPage.text.length+" fave_status:"+this.currentPage.page.favorite+" page_state:"+this.currentPage.page.status);
   };
 
@@ -1086,22 +1408,29 @@ Pebble.addEventListener('appmessage',
       savedPageLists.favoriteStatus = FAVE_STATUS_VALUES[e.payload.favorite];
       console.log('favorite status is now '+savedPageLists.favoriteStatus);
     }
-    if(e.payload.message_code == PEBBLE_MESSAGE_CODES.requestingPageTitles){
+    if(e.payload.message_code == PEBBLE_MESSAGE_CODES.capabilities){
+      handleCapabilities(e.payload);
+    }
+    else if(e.payload.message_code == PEBBLE_MESSAGE_CODES.requestingPageTitles){
       if(debug)console.log('appmessage: Pebble requested ' + e.payload.item_count + " titles starting at " + e.payload.index );
-      savedPageLists.pagesToPebble(e.payload.index,e.payload.item_count);
+      savedPageLists.pagesToPebble(e.payload.index,e.payload.item_count,false,e.payload.request_id);
     }
     else if(e.payload.message_code == PEBBLE_MESSAGE_CODES.loadPage){
       
       if(debug)console.log('appmessage: Pebble requested page at index ' + e.payload.index);
-      savedPage.loadPage(e.payload.index);
+      savedPage.loadPage(e.payload.index,e.payload.request_id);
     }
     else if(e.payload.message_code == PEBBLE_MESSAGE_CODES.getPageText){
       if(savedPage.currentPage){
         if(debug)console.log('appmessage: Sending page text at subpage ' + e.payload.index);
-        savedPage.sendText(e.payload.index);
+        savedPage.sendText(e.payload.index,e.payload.request_id);
       }
       else if(debug)console.log('appmessage: page text requested, but no page is loaded');
     }
+    else if(e.payload.message_code == PEBBLE_MESSAGE_CODES.streamCredits){
+      if(debug)console.log('appmessage: Pebble accepts pushed subpages up to ' + e.payload.index);
+      savedPage.grantCredits(e.payload.index,e.payload.request_id);
+    }
     else if(e.payload.message_code == PEBBLE_MESSAGE_CODES.archivePage){
       savedPage.archiveOrReAdd();
     }
@@ -1140,6 +1469,11 @@ Pebble.addEventListener('appmessage',
       if(debug)console.log('appmessage: removing current page bookmark');
       savedPage.removeCurrentPageBookmark();
     }
+    else if(e.payload.message_code == PEBBLE_MESSAGE_CODES.cancelRequests){
+      if(debug)console.log('appmessage: cancelling requests of type ' + e.payload.content_type);
+      if(e.payload.content_type == REQUEST_TYPES.pageTitles) savedPageLists.cancelRequests();
+      else if(e.payload.content_type == REQUEST_TYPES.pageText) savedPage.cancelRequests();
+    }
   });
           
 //Runs when the config page is opened
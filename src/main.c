@@ -7,6 +7,8 @@
 #include "page_menu.h"
 #include "page_view.h"
 #include "options.h"
+#include "notify.h"
+#include "heap_budget.h"
 
 //----------LOCAL VALUE DEFINITIONS----------
 #define DEBUG_MAIN  //uncomment to enable main program debug logging
@@ -14,9 +16,14 @@
 //----------STATIC FUNCTIONS----------
 
 void handle_init(void) {
+  //measure the heap before anything else allocates
+  budget_init();
   init_options();
   //Register app message functions
   message_handler_init();
+  register_page_menu_handlers();
+  register_page_view_handlers();
+  register_notify_handlers();
   init_main_menu();
 }
 
@@ -2,10 +2,10 @@
 #include "message_handler.h"
 #include "messaging_core.h"
 #include "util.h"
-#include "page_menu.h"
-#include "page_view.h"
 #include "storage_keys.h"
-#include "notify.h"
+#include "message_stats.h"
+#include "text_codec.h"
+#include "src/message_keys.auto.h"
 
 //----------LOCAL VALUE DEFINITIONS----------
 //#define MSG_DEBUG_ENABLED//comment out to disable menu debug logs
@@ -17,24 +17,102 @@
 #define MSG_ERROR(fmt, args...) 
 #endif
 
+//Builds an outbox merge key from a message code, an item index, and
+//any list state that changes the meaning of the request
+#define MERGE_KEY(code,index,state) ((((uint32_t)(code) + 1) << 24) | \
+                                     (((uint32_t)(index) & 0xFFFF) << 8) | \
+                                     ((uint32_t)(state) & 0xFF))
+
+#define MAX_PENDING_REQUESTS 16 //Number of unanswered requests tracked at once
+
+//Gets the outbox message class used to cancel a RequestType
+#define REQUEST_CLASS(type) ((uint8_t)(type) + 1)
+
+//----------PROTOCOL HANDSHAKE----------
+//When javascript starts it sends CODE_INIT_SIGNAL, and the watch answers
+//with CODE_CAPABILITIES describing what it can accept.  Javascript replies
+//with CODE_PROTOCOL_CONFIG, giving the protocol version and subpage size
+//it will use.
+#define PROTOCOL_VERSION 1 //Newest protocol version the watch understands
+
+//Optional protocol features, sent as KEY_FEATURES bit flags
+#define FEATURE_COMPRESSED_TEXT 0x01 //frames may contain compressed text
+#define FEATURE_TEXT_STREAMING 0x02 //javascript may push subpages, see SUBPAGE STREAMING
+#define WATCH_FEATURES (FEATURE_COMPRESSED_TEXT | FEATURE_TEXT_STREAMING)
+
+//----------SUBPAGE STREAMING----------
+//Once the first subpage of a page arrives, the watch sends CODE_STREAM_CREDITS
+//giving the subpage index javascript may push up to, without waiting for
+//requests.  The limit only grows as the page is read, so a lost or merged
+//grant is covered by the next one.  Pushed subpages reuse the request ID of
+//the page load, so pushes for a closed page are discarded.
+
+#if defined(PBL_PLATFORM_APLITE)
+#define PLATFORM_NAME "aplite"
+#elif defined(PBL_PLATFORM_BASALT)
+#define PLATFORM_NAME "basalt"
+#elif defined(PBL_PLATFORM_CHALK)
+#define PLATFORM_NAME "chalk"
+#else
+#define PLATFORM_NAME "unknown"
+#endif
+
+//----------BINARY FRAME FORMAT----------
+//Page title and page text responses arrive as a single byte array
+//tuple instead of one tuple per value.  All values are little-endian.
+//Header:
+//  uint8  version, FRAME_VERSION
+//  uint8  JSMessageCode, also read by messaging_core.c for statistics
+//  uint16 request ID, or 0
+//  int16  item index
+//  int16  item count
+//  uint8  page state
+//  uint8  favorite status
+//  int16  bookmark scroll offset, or -1
+//  uint8  number of sections
+//  uint8  frame flags
+//Each section is a uint16 text length, the UTF-8 text, then a 0 byte, so
+//section text can be used in place as a C string.
+#define FRAME_VERSION 1
+#define FRAME_HEADER_SIZE 14
+#define FRAME_SECTION_OVERHEAD 3 //length prefix and terminator size
+#define FRAME_FLAG_COMPRESSED 0x01 //text sections are compressed, see text_codec.h
+
 //----------APPMESSAGE KEY DEFINITIONS----------
-enum{
-  KEY_MESSAGE_CODE,
-    //int8: identifying the purpose of the message, bi-directional
-  KEY_MESSAGE_TEXT,
-    //cstring: contains the main text associated with the message(if relevant)
-  KEY_NUM_ITEMS,
-    //int16: specifies a quantity
-  KEY_INDEX,
-    //int16: specifies an item index
-  KEY_PAGE_STATE,
-  KEY_FAVORITE,
-  KEY_TAG,
-  KEY_CONTENT_TYPE,
-  KEY_SORT_ORDER,
-  KEY_OPCODE,
-  KEY_SCROLL_OFFSET
-};
+//MessageKey values are generated by wscript from the appKeys in appinfo.json,
+//the same key names app.js uses.  Outgoing values are only written through
+//WRITE_FIELD, so each key is always sent with the type listed here, and a
+//key missing from appinfo.json fails to compile.
+//Incoming keys are read in process_message: MESSAGE_CODE, MESSAGE_TEXT (cstring),
+//OPCODE, PROTOCOL_VERSION, PAGE_SIZE, FEATURES, and FRAME (byte array, see BINARY FRAME FORMAT).
+//Outgoing field columns: key name, C type, dict_write_ function suffix
+#define OUTGOING_FIELDS(FIELD) \
+  FIELD(MESSAGE_CODE, int8_t, int8) \
+  FIELD(ITEM_COUNT, int16_t, int16) \
+  FIELD(INDEX, int16_t, int16) \
+  FIELD(PAGE_STATE, int8_t, int8) \
+  FIELD(FAVORITE, int8_t, int8) \
+  FIELD(CONTENT_TYPE, int8_t, int8) \
+  FIELD(SORT_ORDER, int8_t, int8) \
+  FIELD(SCROLL_OFFSET, int16_t, int16) \
+  FIELD(REQUEST_ID, uint16_t, uint16) \
+  FIELD(PROTOCOL_VERSION, uint8_t, uint8) \
+  FIELD(PLATFORM, const char *, cstring) \
+  FIELD(INBOX_SIZE, uint32_t, uint32) \
+  FIELD(FREE_HEAP, uint32_t, uint32) \
+  FIELD(FEATURES, uint32_t, uint32)
+
+//Defines a typed write function for one outgoing field
+#define DEFINE_FIELD_WRITER(name, type, suffix) \
+  static inline void write_field_##name(DictionaryIterator * iter, type value){ \
+    if(dict_write_##suffix(iter, KEY_##name, value) != DICT_OK){ \
+      MSG_ERROR("write_field:No room for key %d", KEY_##name); \
+    } \
+  }
+OUTGOING_FIELDS(DEFINE_FIELD_WRITER)
+
+//Writes one outgoing field to a message started with begin_message
+#define WRITE_FIELD(iter, name, value) write_field_##name(iter, value)
 
 //----------APPMESSAGE MESSAGE CODES----------
 //Valid message codes for messages sent from Pebble
@@ -48,42 +126,59 @@ typedef enum{
   CODE_CLEAR_LOCAL_STORAGE,
   CODE_UPDATE_TITLES,
   CODE_BOOKMARK_PAGE,
-  CODE_REMOVE_BOOKMARK
+  CODE_REMOVE_BOOKMARK,
+  CODE_CANCEL_REQUESTS,
+    //Message telling javascript to stop work on a RequestType
+  CODE_CAPABILITIES,
+    //Message describing the watch's messaging limits and features
+  CODE_STREAM_CREDITS
+    //Message letting javascript push subpages up to an index
 } PebbleMessageCode;
 
-//Valid message codes for messages received from JavaScript
-typedef enum{
-  CODE_PAGE_TITLE_RESPONSE,
-    //Message providing page titles
-  CODE_PAGE_TEXT_RESPONSE,
-    //Message providing page text
-  CODE_INIT_SIGNAL,
-  CODE_RESET_PAGE_DATA,
-  CODE_OP_SUCCEEDED,
-  CODE_OP_FAILED
-} JSMessageCode;
-
-//Types of operations javascript may report
-typedef enum{
-  OP_LOGIN,
-  OP_LOAD_PAGES,
-  OP_LOAD_TEXT,
-  OP_TOGGLE_FAVE,
-  OP_TOGGLE_ARCHIVE,
-  OP_DELETE_PAGE
-}OpCode;
+//Tracks a request that hasn't been answered yet
+typedef struct{
+  uint16_t id;//request ID, or 0 if the slot is unused
+  PebbleMessageCode code;//the request's message code
+  uint32_t mergeKey;//the request's outbox merge key
+  uint32_t requestTime;//time the request was made, for latency statistics
+}PendingRequest;
 
 //----------LOCAL VARIABLES----------
 PageState pageState = STATE_ALL;
 FavoriteStatus favoriteStatus = FAVE_ALL;
 SortType sortType = SORT_NEWEST;
 
+static PendingRequest pendingRequests[MAX_PENDING_REQUESTS];
+static int nextPendingSlot = 0;//pending request slot to overwrite next if none are free
+static uint16_t lastRequestId = 0;//most recently assigned request ID
+static uint8_t protocolVersion = 0;//version chosen by javascript, 0 before the handshake
+static int textChunkSize = 0;//characters per subpage chosen by javascript, or 0 if unknown
+static uint32_t protocolFeatures = 0;//optional features both sides support
+static uint16_t textStreamId = 0;//request ID on pushed subpages, or 0 if no page is loading
+static MessageHandler messageHandlers[NUM_JS_MESSAGE_CODES];//handlers for each JSMessageCode
+
 static void process_message(DictionaryIterator *iterator);
+static bool accept_message(InboxMessage * message);
+static void handle_init_signal(InboxMessage * message);
+static void handle_protocol_config(InboxMessage * message);
+static void send_capabilities();
+static bool decode_frame(uint8_t * data, uint16_t size, InboxMessage * message);
+static char * read_section(InboxMessage * message, uint16_t * offset, uint16_t * length);
+static int read_tuple_int(Tuple * tuple);
+static uint16_t read_uint16(const uint8_t * data);
+static uint16_t new_request(PebbleMessageCode code, uint32_t mergeKey);
+static bool end_request(uint16_t id, uint32_t mergeKey);
+static void forget_request(uint16_t id);
+static void forget_replaced_request(uint16_t id, uint32_t mergeKey);
+static bool accept_response(uint16_t id, PebbleMessageCode code1, PebbleMessageCode code2);
+static int invalidate_requests(PebbleMessageCode code);
 //----------PUBLIC FUNCTIONS----------
 //Initializes AppMessage functionality
 void message_handler_init(){
   open_messaging();
   register_inbox_handler(process_message);
+  register_message_handler(CODE_INIT_SIGNAL, handle_init_signal);
+  register_message_handler(CODE_PROTOCOL_CONFIG, handle_protocol_config);
   toggle_message_sending(false);
 }
 
@@ -93,34 +188,46 @@ void messaging_deinit(){
 }
 
 //sets the page state to request when getting pages
-void setPageState(PageState newState){pageState = newState;}
+void setPageState(PageState newState){
+  if(newState != pageState) invalidate_requests(CODE_PAGE_TITLE_REQUEST);
+  pageState = newState;
+}
 
 //sets the favorite status to request when getting pages
-void setFavoriteStatus(FavoriteStatus newFavStatus){favoriteStatus = newFavStatus;}
+void setFavoriteStatus(FavoriteStatus newFavStatus){
+  if(newFavStatus != favoriteStatus) invalidate_requests(CODE_PAGE_TITLE_REQUEST);
+  favoriteStatus = newFavStatus;
+}
 
 //sets the page sort order to request when getting pages
-void setSortType(SortType newSortType){sortType = newSortType;}
+void setSortType(SortType newSortType){
+  if(newSortType != sortType) invalidate_requests(CODE_PAGE_TITLE_REQUEST);
+  sortType = newSortType;
+}
 
 
 /**
 *Requests updated page titles
 *@param updateType the appropriate update request code
+*@return false if the request was rejected because the outbox is full
 */
-void get_page_titles(int firstTitleIndex, int numTitles){
+bool get_page_titles(int firstTitleIndex, int numTitles){
   MSG_DEBUG("get_page_titles:Requesting %d titles at %d",numTitles,firstTitleIndex);
-  uint8_t buf[PEBBLE_DICT_SIZE] = {0};//default buffer values to 0 to avoid 
-    //junk data overwriting legitimate keys
-  DictionaryIterator iter;
-  dict_write_begin(&iter,buf,PEBBLE_DICT_SIZE);
-  dict_write_int8(&iter, KEY_MESSAGE_CODE, CODE_PAGE_TITLE_REQUEST);
-  dict_write_int16(&iter, KEY_INDEX, firstTitleIndex);
-  dict_write_int16(&iter, KEY_NUM_ITEMS, numTitles);
-  dict_write_int8(&iter, KEY_PAGE_STATE, pageState);
-  dict_write_int8(&iter, KEY_FAVORITE, favoriteStatus);
-  dict_write_int8(&iter, KEY_SORT_ORDER, sortType);
-  dict_write_end(&iter);
+  int listState = (pageState * 3 + favoriteStatus) * 4 + sortType;
+  uint32_t mergeKey = MERGE_KEY(CODE_PAGE_TITLE_REQUEST, firstTitleIndex, listState);
+  DictionaryIterator * iter = begin_message(MESSAGE_PRIORITY_BACKGROUND,
+      REQUEST_CLASS(REQUEST_PAGE_TITLES), mergeKey);
+  if(iter == NULL) return false;
+  WRITE_FIELD(iter, MESSAGE_CODE, CODE_PAGE_TITLE_REQUEST);
+  WRITE_FIELD(iter, INDEX, firstTitleIndex);
+  WRITE_FIELD(iter, ITEM_COUNT, numTitles);
+  WRITE_FIELD(iter, PAGE_STATE, pageState);
+  WRITE_FIELD(iter, FAVORITE, favoriteStatus);
+  WRITE_FIELD(iter, SORT_ORDER, sortType);
+  uint16_t id = new_request(CODE_PAGE_TITLE_REQUEST, mergeKey);
+  WRITE_FIELD(iter, REQUEST_ID, id);
   MSG_DEBUG("get_page_titles:Attempting to send request");
-  add_message(buf);
+  return end_request(id, mergeKey);
 }
 
 /**
@@ -128,32 +235,60 @@ void get_page_titles(int firstTitleIndex, int numTitles){
 *pageIndex: the page to load
 */
 void request_page(int pageIndex){
-  uint8_t buf[PEBBLE_DICT_SIZE] = {0};//default buffer values to 0 to avoid 
-    //junk data overwriting legitimate keys
-  DictionaryIterator iter;
-  dict_write_begin(&iter,buf,PEBBLE_DICT_SIZE);
-  dict_write_int8(&iter, KEY_MESSAGE_CODE, CODE_LOAD_PAGE_REQUEST);
-  dict_write_int16(&iter, KEY_INDEX, pageIndex);
-  dict_write_end(&iter);
+  //text from any previously requested page is no longer wanted
+  invalidate_requests(CODE_LOAD_PAGE_REQUEST);
+  invalidate_requests(CODE_PAGE_TEXT_REQUEST);
+  textStreamId = 0;
+  //only the most recently selected page needs to load
+  uint32_t mergeKey = MERGE_KEY(CODE_LOAD_PAGE_REQUEST, 0, 0);
+  DictionaryIterator * iter = begin_message(MESSAGE_PRIORITY_INTERACTIVE,
+      REQUEST_CLASS(REQUEST_PAGE_TEXT), mergeKey);
+  if(iter == NULL) return;
+  WRITE_FIELD(iter, MESSAGE_CODE, CODE_LOAD_PAGE_REQUEST);
+  WRITE_FIELD(iter, INDEX, pageIndex);
+  textStreamId = new_request(CODE_LOAD_PAGE_REQUEST, mergeKey);
+  WRITE_FIELD(iter, REQUEST_ID, textStreamId);
   MSG_DEBUG("request_page:Attempting to send request");
-  add_message(buf);
+  if(!end_request(textStreamId, mergeKey)) textStreamId = 0;
 }
 
 /**
 *gets text from the loaded page
 *numChars: number of characters to load
 *offset: first character index
+*return: false if the request was rejected because the outbox is full
 */
-void get_page_text(int subPage){
-  uint8_t buf[PEBBLE_DICT_SIZE] = {0};//default buffer values to 0 to avoid 
-    //junk data overwriting legitimate keys
-  DictionaryIterator iter;
-  dict_write_begin(&iter,buf,PEBBLE_DICT_SIZE);
-  dict_write_int8(&iter, KEY_MESSAGE_CODE, CODE_PAGE_TEXT_REQUEST);
-  dict_write_int16(&iter, KEY_INDEX, subPage);
-  dict_write_end(&iter);
-  MSG_DEBUG("get_page_titles:Attempting to send request");
-  add_message(buf); 
+bool get_page_text(int subPage){
+  uint32_t mergeKey = MERGE_KEY(CODE_PAGE_TEXT_REQUEST, subPage, 0);
+  DictionaryIterator * iter = begin_message(MESSAGE_PRIORITY_BACKGROUND,
+      REQUEST_CLASS(REQUEST_PAGE_TEXT), mergeKey);
+  if(iter == NULL) return false;
+  WRITE_FIELD(iter, MESSAGE_CODE, CODE_PAGE_TEXT_REQUEST);
+  WRITE_FIELD(iter, INDEX, subPage);
+  uint16_t id = new_request(CODE_PAGE_TEXT_REQUEST, mergeKey);
+  WRITE_FIELD(iter, REQUEST_ID, id);
+  MSG_DEBUG("get_page_text:Attempting to send request");
+  return end_request(id, mergeKey);
+}
+
+/**
+*Lets javascript push subpages of the loaded page without waiting
+*for requests, see SUBPAGE STREAMING
+*@param limit javascript may push subpages with indexes below this
+*@return true if the grant was queued, false if javascript doesn't
+*support streaming, no page is loading, or the outbox is full
+*/
+bool grant_text_credits(int limit){
+  if(!(protocolFeatures & FEATURE_TEXT_STREAMING) || textStreamId == 0) return false;
+  //only the newest limit matters
+  DictionaryIterator * iter = begin_message(MESSAGE_PRIORITY_INTERACTIVE,
+      REQUEST_CLASS(REQUEST_PAGE_TEXT), MERGE_KEY(CODE_STREAM_CREDITS, 0, 0));
+  if(iter == NULL) return false;
+  WRITE_FIELD(iter, MESSAGE_CODE, CODE_STREAM_CREDITS);
+  WRITE_FIELD(iter, INDEX, limit);
+  WRITE_FIELD(iter, REQUEST_ID, textStreamId);
+  MSG_DEBUG("grant_text_credits:Streaming subpages up to %d",limit);
+  return end_message() != MESSAGE_REJECTED;
 }
 
 /**
@@ -185,12 +320,12 @@ void send_action(JSAction action){
       MSG_ERROR("send_page_action: Invalid action code %d",action);
       return;
   }
-  uint8_t buf[PEBBLE_DICT_SIZE] = {0};//default buffer values to 0 to avoid 
-  DictionaryIterator iter;
-  dict_write_begin(&iter,buf,PEBBLE_DICT_SIZE);
-  dict_write_int8(&iter, KEY_MESSAGE_CODE, actionCode);
-  dict_write_end(&iter);
-  add_message(buf);
+  //actions like favorite toggle state, so repeated actions are never merged
+  DictionaryIterator * iter = begin_message(MESSAGE_PRIORITY_INTERACTIVE, MESSAGE_CLASS_NONE,
+                                            MESSAGE_NO_MERGE);
+  if(iter == NULL) return;
+  WRITE_FIELD(iter, MESSAGE_CODE, actionCode);
+  end_message();
 }
 
 /**
@@ -199,110 +334,403 @@ void send_action(JSAction action){
 *scrollOffset: amount scrolled past the current subpage's start
 */
 void bookmark_current_page(int subPage, int scrollOffset){
-  uint8_t buf[PEBBLE_DICT_SIZE] = {0};//default buffer values to 0 to avoid 
-    //junk data overwriting legitimate keys
-  DictionaryIterator iter;
-  dict_write_begin(&iter,buf,PEBBLE_DICT_SIZE);
-  dict_write_int8(&iter, KEY_MESSAGE_CODE, CODE_BOOKMARK_PAGE);
-  dict_write_int16(&iter, KEY_INDEX, subPage);
-  dict_write_int16(&iter, KEY_SCROLL_OFFSET, scrollOffset);
-  dict_write_end(&iter);
-  MSG_DEBUG("get_page_titles:Attempting to send request");
-  add_message(buf); 
-  
+  //only the latest bookmark position needs to be saved
+  DictionaryIterator * iter = begin_message(MESSAGE_PRIORITY_INTERACTIVE, MESSAGE_CLASS_NONE,
+                                            MERGE_KEY(CODE_BOOKMARK_PAGE, 0, 0));
+  if(iter == NULL) return;
+  WRITE_FIELD(iter, MESSAGE_CODE, CODE_BOOKMARK_PAGE);
+  WRITE_FIELD(iter, INDEX, subPage);
+  WRITE_FIELD(iter, SCROLL_OFFSET, scrollOffset);
+  MSG_DEBUG("bookmark_current_page:Attempting to send request");
+  end_message();
+}
+
+/**
+*Sets the function that handles a type of received message,
+*replacing any previous handler
+*@param code the message code to handle
+*@param handler the handler function, or NULL to ignore the message
+*/
+void register_message_handler(JSMessageCode code, MessageHandler handler){
+  if(code < NUM_JS_MESSAGE_CODES) messageHandlers[code] = handler;
+}
+
+/**
+*Gets the next text section of a received frame
+*@param message a received message
+*@param offset the section offset, 0 for the first section.  This is
+*moved to the following section.
+*@return the section text, or NULL if there are no more sections
+*/
+char * message_next_section(InboxMessage * message, uint16_t * offset){
+  uint16_t length;
+  return read_section(message, offset, &length);
+}
+
+/**
+*Copies the text of a received message, decompressing it if needed.
+*Frame messages use their first section.
+*@param message a received message
+*@return the text, allocated with malloc, or NULL if the message
+*has no valid text
+*/
+char * message_copy_text(InboxMessage * message){
+  if(message->sections == NULL){
+    return message->text != NULL ? malloc_strcpy(NULL, message->text) : NULL;
+  }
+  uint16_t offset = 0;
+  uint16_t length;
+  char * section = read_section(message, &offset, &length);
+  if(section == NULL) return NULL;
+  if(message->flags & FRAME_FLAG_COMPRESSED){
+    char * text = text_decompress((uint8_t *) section, length);
+    if(text == NULL){
+      MSG_ERROR("message_copy_text:Couldn't decompress message text");
+    }
+    return text;
+  }
+  return malloc_strcpy(NULL, section);
+}
+
+/**
+*Gets the number of characters javascript sends per subpage
+*@return the subpage size chosen during the protocol handshake,
+*or 0 if the handshake hasn't finished
+*/
+int get_text_chunk_size(){
+  return textChunkSize;
 }
 
+/**
+*Cancels all unanswered requests of one type.  Queued requests are
+*removed, and javascript is told to stop any work on requests it
+*already received.
+*@param type the type of request to cancel
+*/
+void cancel_requests(RequestType type){
+  if(!is_messaging_open())return;
+  int cancelled = cancel_messages(REQUEST_CLASS(type));
+  switch(type){
+    case REQUEST_PAGE_TITLES:
+      cancelled += invalidate_requests(CODE_PAGE_TITLE_REQUEST);
+      break;
+    case REQUEST_PAGE_TEXT:
+      cancelled += invalidate_requests(CODE_LOAD_PAGE_REQUEST);
+      cancelled += invalidate_requests(CODE_PAGE_TEXT_REQUEST);
+      if(textStreamId != 0) cancelled++;
+      textStreamId = 0;
+      break;
+  }
+  if(cancelled == 0)return;
+  MSG_DEBUG("cancel_requests:Cancelling requests of type %d",type);
+  DictionaryIterator * iter = begin_message(MESSAGE_PRIORITY_INTERACTIVE, MESSAGE_CLASS_NONE,
+                                            MERGE_KEY(CODE_CANCEL_REQUESTS, type, 0));
+  if(iter == NULL) return;
+  WRITE_FIELD(iter, MESSAGE_CODE, CODE_CANCEL_REQUESTS);
+  WRITE_FIELD(iter, CONTENT_TYPE, type);
+  end_message();
+}
 
 //----------STATIC FUNCTIONS----------
 
+/**
+*Reads a received message in one pass over its tuples, then passes it to
+*the handler registered for its message code
+*@param iterator the received message
+*/
 static void process_message(DictionaryIterator *iterator){
-  Tuple *message_code = dict_find(iterator,KEY_MESSAGE_CODE);
-  Tuple *message_text = dict_find(iterator,KEY_MESSAGE_TEXT);
-  Tuple *item_count = dict_find(iterator,KEY_NUM_ITEMS);
-  Tuple *index = dict_find(iterator,KEY_INDEX);
-  Tuple *pageState = dict_find(iterator,KEY_PAGE_STATE);
-  Tuple *faveStatus = dict_find(iterator,KEY_FAVORITE);
-  Tuple *scrollOffset = dict_find(iterator,KEY_SCROLL_OFFSET);
-  Tuple * op = dict_find(iterator,KEY_OPCODE);
-  if(message_code != NULL){
-    switch((JSMessageCode) message_code->value->int32){
-      case CODE_PAGE_TITLE_RESPONSE:{
-        MSG_DEBUG("inbox_received_callback:Recieved CODE_PAGE_TITLE_RESPONSE");
-        if((message_text != NULL)&&(item_count != NULL)&&(index != NULL)){
-          update_titles(message_text->value->cstring, index->value->int16);
-          MSG_DEBUG("Received new title list at index %d",index->value->int16);
-          MSG_DEBUG("new titles:%s",message_text->value->cstring);
-        }}
+  InboxMessage message = {.code = NUM_JS_MESSAGE_CODES, .scrollOffset = -1, .op = -1};
+  for(Tuple * tuple = dict_read_first(iterator); tuple != NULL; tuple = dict_read_next(iterator)){
+    switch(tuple->key){
+      case KEY_MESSAGE_CODE:
+        message.code = (JSMessageCode) read_tuple_int(tuple);
         break;
-      case CODE_PAGE_TEXT_RESPONSE:{
-        MSG_DEBUG("inbox_received_callback:Recieved CODE_PAGE_TEXT_RESPONSE");
-        char * pageText = NULL;
-        int subpageIndex = 0;
-        int numSubpages = 1;
-        int state = 0;
-        int fave = 0;
-        int bookmarkOffset = -1;
-        if(message_text != NULL) pageText = message_text->value->cstring;
-        if(index != NULL)subpageIndex = index->value->int16;
-        if(item_count != NULL) numSubpages = item_count->value->int16;
-        if(pageState != NULL) state = pageState->value->int16;
-        if(faveStatus != NULL)fave = faveStatus->value->int16;
-        if(scrollOffset != NULL)bookmarkOffset = scrollOffset->value->int16;
-        load_page_text(pageText,subpageIndex,numSubpages,state,fave,bookmarkOffset);
-        }
+      case KEY_MESSAGE_TEXT:
+        message.text = tuple->value->cstring;
         break;
-      case CODE_INIT_SIGNAL:{
-        MSG_DEBUG("inbox_received_callback:Recieved CODE_INIT_SIGNAL");
-        toggle_message_sending(true);
-        }
+      case KEY_OPCODE:
+        message.op = read_tuple_int(tuple);
         break;
-      case CODE_RESET_PAGE_DATA:{
-        MSG_DEBUG("inbox_received_callback:Recieved CODE_RESET_PAGE_DATA");
-        unload_page();
-        destroy_page_menu();
-        init_page_menu();
-      }
-      break;
-      case CODE_OP_FAILED:{
-        MSG_DEBUG("inbox_received_callback:Recieved CODE_OP_FAILED, %s",message_text->value->cstring);
-        if(op != NULL){
-          switch((OpCode) op->value->int16){
-            case OP_LOGIN:
-              show_notification(message_text->value->cstring, -1, GColorRed,
-                                (NotifyCallbacks){.onSuddenClose=closeApp});
-              break;
-            case OP_LOAD_PAGES:
-              show_notification(message_text->value->cstring, 3, GColorRed,
-                                (NotifyCallbacks){.onSuddenClose=closeList});
-              break;
-            case OP_LOAD_TEXT:
-              show_notification(message_text->value->cstring, 3, GColorRed,
-                                (NotifyCallbacks){.onSuddenClose=closeText});
-              break;
-            case OP_TOGGLE_FAVE:
-              show_notification(message_text->value->cstring, 3, GColorRed,
-                              (NotifyCallbacks){0});
-              break;
-            case OP_TOGGLE_ARCHIVE:
-              show_notification(message_text->value->cstring, 3, GColorRed,
-                              (NotifyCallbacks){0});
-              break;
-            case OP_DELETE_PAGE:
-              show_notification(message_text->value->cstring, 3, GColorRed,
-                                (NotifyCallbacks){0});
-              break;
-          }
+      case KEY_PROTOCOL_VERSION:
+        message.protocolVersion = read_tuple_int(tuple);
+        break;
+      case KEY_PAGE_SIZE:
+        message.pageSize = read_tuple_int(tuple);
+        break;
+      case KEY_FEATURES:
+        message.features = read_tuple_int(tuple);
+        break;
+      case KEY_FRAME:
+        if(!decode_frame(tuple->value->data, tuple->length, &message)){
+          MSG_ERROR("process_message:Discarding invalid frame");
+          return;
         }
-        else show_notification(message_text->value->cstring, 3, GColorRed,
-                              (NotifyCallbacks){0});
+        break;
+    }
+  }
+  if(message.code >= NUM_JS_MESSAGE_CODES){
+    MSG_ERROR("process_message:Received message with no valid message code!");
+    return;
+  }
+  if(!accept_message(&message)) return;
+  MSG_DEBUG("process_message:Received message code %d",message.code);
+  if(messageHandlers[message.code] != NULL) messageHandlers[message.code](&message);
+}
+
+/**
+*Checks if a received message should be handled.  Responses to
+*requests that were cancelled or replaced are discarded.
+*@param message the received message
+*@return true if the message should be handled
+*/
+static bool accept_message(InboxMessage * message){
+  switch(message->code){
+    case CODE_PAGE_TITLE_RESPONSE:
+      return accept_response(message->requestId, CODE_PAGE_TITLE_REQUEST, CODE_PAGE_TITLE_REQUEST);
+    case CODE_PAGE_TEXT_RESPONSE:
+      //pushed subpages carry the page load request ID, see SUBPAGE STREAMING
+      if(message->requestId != 0 && message->requestId == textStreamId){
+        accept_response(message->requestId, CODE_LOAD_PAGE_REQUEST, CODE_LOAD_PAGE_REQUEST);
+        return true;
       }
+      return accept_response(message->requestId, CODE_LOAD_PAGE_REQUEST, CODE_PAGE_TEXT_REQUEST);
+    default:
+      return true;
+  }
+}
+
+/**
+*Starts sending messages once javascript is ready
+*@param message the CODE_INIT_SIGNAL message
+*/
+static void handle_init_signal(InboxMessage * message){
+  //queue capabilities first, so javascript has them before any requests
+  send_capabilities();
+  toggle_message_sending(true);
+}
+
+/**
+*Records the protocol version, subpage size and features javascript chose
+*@param message the CODE_PROTOCOL_CONFIG message
+*/
+static void handle_protocol_config(InboxMessage * message){
+  protocolVersion = message->protocolVersion;
+  textChunkSize = message->pageSize;
+  protocolFeatures = message->features & WATCH_FEATURES;
+  MSG_DEBUG("handle_protocol_config:Using protocol version %d, subpage size %d, features %d",
+            protocolVersion, textChunkSize, (int) protocolFeatures);
+}
+
+/**
+*Tells javascript the watch's platform, inbox size, free memory and
+*supported features, so it can choose how much to send at once
+*/
+static void send_capabilities(){
+  DictionaryIterator * iter = begin_message(MESSAGE_PRIORITY_INTERACTIVE, MESSAGE_CLASS_NONE,
+                                            MERGE_KEY(CODE_CAPABILITIES, 0, 0));
+  if(iter == NULL) return;
+  WRITE_FIELD(iter, MESSAGE_CODE, CODE_CAPABILITIES);
+  WRITE_FIELD(iter, PROTOCOL_VERSION, PROTOCOL_VERSION);
+  WRITE_FIELD(iter, PLATFORM, PLATFORM_NAME);
+  WRITE_FIELD(iter, INBOX_SIZE, get_inbox_size());
+  WRITE_FIELD(iter, FREE_HEAP, heap_bytes_free());
+  WRITE_FIELD(iter, FEATURES, WATCH_FEATURES);
+  MSG_DEBUG("send_capabilities:inbox %d bytes, %d bytes free",
+            (int) get_inbox_size(), (int) heap_bytes_free());
+  end_message();
+}
+
+/**
+*Reads and checks a binary response frame header, and checks that
+*every section fits in the frame and is null-terminated
+*@param data the frame bytes
+*@param size the frame size in bytes
+*@param message set to the frame's header values and sections
+*@return true if the frame is valid
+*/
+static bool decode_frame(uint8_t * data, uint16_t size, InboxMessage * message){
+  if(size < FRAME_HEADER_SIZE || data[0] != FRAME_VERSION){
+    MSG_ERROR("decode_frame:Bad frame header, size %d",size);
+    return false;
+  }
+  message->code = (JSMessageCode) data[1];
+  message->requestId = read_uint16(data + 2);
+  message->index = (int16_t) read_uint16(data + 4);
+  message->itemCount = (int16_t) read_uint16(data + 6);
+  message->pageState = data[8];
+  message->favorite = data[9];
+  message->scrollOffset = (int16_t) read_uint16(data + 10);
+  message->numSections = data[12];
+  message->flags = data[13];
+  message->sections = data + FRAME_HEADER_SIZE;
+  message->sectionsSize = size - FRAME_HEADER_SIZE;
+  uint16_t offset = 0;
+  for(int i = 0; i < message->numSections; i++){
+    if(message->sectionsSize - offset < FRAME_SECTION_OVERHEAD) return false;
+    uint16_t length = read_uint16(message->sections + offset);
+    if(message->sectionsSize - offset - FRAME_SECTION_OVERHEAD < length) return false;
+    offset += length + FRAME_SECTION_OVERHEAD;
+    if(message->sections[offset - 1] != '\0') return false;
+  }
+  //ignore anything after the last section
+  message->sectionsSize = offset;
+  return true;
+}
+
+/**
+*Gets the next text section from a received frame
+*@param message a message with sections checked by decode_frame
+*@param offset the section offset, 0 for the first section.  This is
+*moved to the following section.
+*@param length set to the section length
+*@return the section text, or NULL if there are no more sections
+*/
+static char * read_section(InboxMessage * message, uint16_t * offset, uint16_t * length){
+  if(message->sections == NULL ||
+     *offset + FRAME_SECTION_OVERHEAD > message->sectionsSize) return NULL;
+  *length = read_uint16(message->sections + *offset);
+  char * text = (char *) message->sections + *offset + 2;
+  *offset += *length + FRAME_SECTION_OVERHEAD;
+  return text;
+}
+
+/**
+*Reads an integer tuple of any width
+*@param tuple an integer tuple
+*@return the tuple's value
+*/
+static int read_tuple_int(Tuple * tuple){
+  switch(tuple->length){
+    case 1:
+      return tuple->type == TUPLE_INT ? tuple->value->int8 : tuple->value->uint8;
+    case 2:
+      return tuple->type == TUPLE_INT ? tuple->value->int16 : tuple->value->uint16;
+    default:
+      return tuple->value->int32;
+  }
+}
+
+/**
+*Reads a little-endian 16 bit value, which may not be aligned
+*@param data the first byte of the value
+*@return the value read
+*/
+static uint16_t read_uint16(const uint8_t * data){
+  return data[0] | (data[1] << 8);
+}
+
+/**
+*Assigns an ID to a new request and tracks it until it's answered.  If
+*every slot holds an unanswered request, the oldest one is forgotten.
+*@param code the request's message code
+*@param mergeKey the request's outbox merge key
+*@return the new request ID
+*/
+static uint16_t new_request(PebbleMessageCode code, uint32_t mergeKey){
+  lastRequestId++;
+  if(lastRequestId == 0) lastRequestId++;//0 marks unused slots
+  int slot = nextPendingSlot;
+  for(int i = 0; i < MAX_PENDING_REQUESTS; i++){
+    int candidate = (nextPendingSlot + i) % MAX_PENDING_REQUESTS;
+    if(pendingRequests[candidate].id == 0){
+      slot = candidate;
       break;
-      case CODE_OP_SUCCEEDED:{
-        MSG_DEBUG("inbox_received_callback:Recieved CODE_OP_SUCCEEDED, %s",message_text->value->cstring);
-        show_notification(message_text->value->cstring, 3, GColorGreen,
-                         (NotifyCallbacks){.onDisappear = hide_notification});
-      }
-    }return;
+    }
+  }
+  pendingRequests[slot] = (PendingRequest){.id = lastRequestId, .code = code,
+                                           .mergeKey = mergeKey, .requestTime = getTimeMs()};
+  nextPendingSlot = (slot + 1) % MAX_PENDING_REQUESTS;
+  return lastRequestId;
+}
+
+/**
+*Adds a request started with begin_message to the outbox, and stops
+*tracking any request ID that will never be answered: the new
+*request's ID if the outbox rejects it, or the ID of the queued
+*request it replaces
+*@param id the new request's ID
+*@param mergeKey the new request's merge key
+*@return false if the request was rejected because the outbox is full
+*/
+static bool end_request(uint16_t id, uint32_t mergeKey){
+  MessageQueueResult result = end_message();
+  if(result == MESSAGE_REJECTED) forget_request(id);
+  else if(result == MESSAGE_MERGED) forget_replaced_request(id, mergeKey);
+  return result != MESSAGE_REJECTED;
+}
+
+/**
+*Stops tracking a request that was never sent
+*@param id the request ID
+*/
+static void forget_request(uint16_t id){
+  for(int i = 0; i < MAX_PENDING_REQUESTS; i++){
+    if(pendingRequests[i].id == id) pendingRequests[i].id = 0;
+  }
+}
+
+/**
+*Stops tracking the queued request a new request replaced.  Only one
+*request with a merge key waits in the outbox at a time, and requests
+*already sent are older, so it's the newest other request with the key.
+*@param id the new request's ID
+*@param mergeKey the new request's merge key
+*/
+static void forget_replaced_request(uint16_t id, uint32_t mergeKey){
+  PendingRequest * replaced = NULL;
+  uint16_t replacedAge = 0;
+  for(int i = 0; i < MAX_PENDING_REQUESTS; i++){
+    PendingRequest * request = &pendingRequests[i];
+    //IDs count up, so the newest request has the smallest ID difference
+    uint16_t age = id - request->id;
+    if(request->id != 0 && age != 0 && request->mergeKey == mergeKey &&
+       (replaced == NULL || age < replacedAge)){
+      replaced = request;
+      replacedAge = age;
+    }
+  }
+  if(replaced == NULL) return;
+  MSG_DEBUG("forget_replaced_request:Request %d replaced by %d",replaced->id,id);
+  replaced->id = 0;
+}
+
+/**
+*Checks if a response answers a pending request, and stops
+*tracking that request if it does.
+*@param id the response's request ID, or 0
+*@param code1 a request code the response may answer
+*@param code2 another request code the response may answer
+*@return true if the response should be processed, false if it's stale.
+*Responses without a request ID are always accepted.
+*/
+static bool accept_response(uint16_t id, PebbleMessageCode code1, PebbleMessageCode code2){
+  if(id == 0) return true;
+  for(int i = 0; i < MAX_PENDING_REQUESTS; i++){
+    PendingRequest * request = &pendingRequests[i];
+    if(request->id == id &&
+       (request->code == code1 || request->code == code2)){
+      request->id = 0;
+      stats_add_latency(request->code, getTimeMs() - request->requestTime);
+      return true;
+    }
+  }
+  MSG_DEBUG("accept_response:Discarding stale response to request %d",id);
+  return false;
+}
+
+/**
+*Stops tracking all pending requests of one type, so
+*their responses will be discarded
+*@param code the message code of requests to invalidate
+*@return the number of pending requests invalidated
+*/
+static int invalidate_requests(PebbleMessageCode code){
+  int invalidated = 0;
+  for(int i = 0; i < MAX_PENDING_REQUESTS; i++){
+    if(pendingRequests[i].id != 0 && pendingRequests[i].code == code){
+      pendingRequests[i].id = 0;
+      invalidated++;
+    }
   }
-  MSG_ERROR("inbox_dropped_callback:Received message with no message code!");
+  return invalidated;
 }
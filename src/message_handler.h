@@ -7,6 +7,82 @@
 #pragma once
 #include <pebble.h>
 
+//Valid message codes for messages received from JavaScript
+typedef enum{
+  CODE_PAGE_TITLE_RESPONSE,
+    //Message providing page titles
+  CODE_PAGE_TEXT_RESPONSE,
+    //Message providing page text
+  CODE_INIT_SIGNAL,
+  CODE_RESET_PAGE_DATA,
+  CODE_OP_SUCCEEDED,
+  CODE_OP_FAILED,
+  CODE_PROTOCOL_CONFIG,
+    //Message giving the protocol version and sizes javascript will use
+  NUM_JS_MESSAGE_CODES
+} JSMessageCode;
+
+//Types of operations javascript may report
+typedef enum{
+  OP_LOGIN,
+  OP_LOAD_PAGES,
+  OP_LOAD_TEXT,
+  OP_TOGGLE_FAVE,
+  OP_TOGGLE_ARCHIVE,
+  OP_DELETE_PAGE
+}OpCode;
+
+//A received message, read from the inbox in one pass.  Message text and
+//frame sections point into the inbox buffer, so they're only valid
+//until the message handler returns.
+typedef struct{
+  JSMessageCode code;//message code
+  uint16_t requestId;//request being answered, or 0
+  int index;//item index
+  int itemCount;//item count
+  int pageState;//PageState value
+  int favorite;//FavoriteStatus value
+  int scrollOffset;//bookmark scroll offset, or -1
+  int op;//OpCode of a finished operation, or -1
+  int protocolVersion;//protocol version, or 0
+  int pageSize;//subpage size, or 0
+  uint32_t features;//optional protocol features, or 0
+  char * text;//message text, or NULL
+  uint8_t flags;//frame flags
+  uint8_t numSections;//number of frame text sections
+  uint8_t * sections;//first frame section, or NULL
+  uint16_t sectionsSize;//total size of all frame sections
+}InboxMessage;
+
+//Handles one type of received message
+typedef void (* MessageHandler)(InboxMessage * message);
+
+/**
+*Sets the function that handles a type of received message,
+*replacing any previous handler
+*code: the message code to handle
+*handler: the handler function, or NULL to ignore the message
+*/
+void register_message_handler(JSMessageCode code, MessageHandler handler);
+
+/**
+*Gets the next text section of a received frame
+*message: a received message
+*offset: the section offset, 0 for the first section.  This is
+*moved to the following section.
+*return: the section text, or NULL if there are no more sections
+*/
+char * message_next_section(InboxMessage * message, uint16_t * offset);
+
+/**
+*Copies the text of a received message, decompressing it if needed.
+*Frame messages use their first section.
+*message: a received message
+*return: the text, allocated with malloc, or NULL if the message
+*has no valid text
+*/
+char * message_copy_text(InboxMessage * message);
+
 
 
 
@@ -59,8 +135,9 @@ void setSortType(SortType newSortType);
 /**
 *Requests updated page titles
 *@param updateType the appropriate update request code
+*@return false if the request was rejected because the outbox is full
 */
-void get_page_titles(int firstTitleIndex, int numTitles);
+bool get_page_titles(int firstTitleIndex, int numTitles);
 
 
 /**
@@ -73,8 +150,18 @@ void request_page(int pageIndex);
 *gets text from the loaded page
 *subPage: index of the page section
 *to load
+*return: false if the request was rejected because the outbox is full
 */
-void get_page_text(int subPage);
+bool get_page_text(int subPage);
+
+/**
+*Lets javascript push subpages of the loaded page without
+*waiting for requests
+*limit: javascript may push subpages with indexes below this
+*return: true if the grant was queued, false if javascript doesn't
+*support streaming, no page is loading, or the outbox is full
+*/
+bool grant_text_credits(int limit);
 
 //valid page actions
 typedef enum{
@@ -99,6 +186,22 @@ void send_action(JSAction action);
 */
 void bookmark_current_page(int subPage, int scrollOffset);
 
+//types of requests that can be cancelled
+typedef enum{
+  REQUEST_PAGE_TITLES,
+  REQUEST_PAGE_TEXT
+}RequestType;
 
+/**
+*Cancels all unanswered requests of one type, so
+*no more data is sent for a closed view
+*type: the type of request to cancel
+*/
+void cancel_requests(RequestType type);
 
-
+/**
+*Gets the number of characters javascript sends per subpage
+*return: the subpage size chosen during the protocol handshake,
+*or 0 if the handshake hasn't finished
+*/
+int get_text_chunk_size();
@@ -0,0 +1,221 @@
+#include <pebble.h>
+#include "message_stats.h"
+
+//----------LOCAL VALUE DEFINITIONS----------
+#define NUM_QUEUES 2 //Number of message queues with tracked depths
+#define NUM_FAILURE_REASONS 16 //One slot per AppMessageResult bit
+#define NUM_LATENCY_BUCKETS 8 //Latency histogram buckets
+#define FIRST_LATENCY_BUCKET 64 //Upper limit of the first bucket in ms, each bucket doubles
+#define STATS_LOG_BUFFER_SIZE 2048 //Buffer size used when logging statistics
+
+//Appends formatted text to buffer at offset, stopping at the end of the buffer
+#define STATS_APPEND(fmt, ...) do{ \
+    if((size_t) offset < size - 1){ \
+      int written = snprintf(buffer + offset, size - offset, fmt, ##__VA_ARGS__); \
+      if(written > 0) offset += written; \
+      if((size_t) offset >= size) offset = size - 1; \
+    } \
+  }while(0)
+
+//Statistics for one message code
+typedef struct{
+  uint16_t counts[NUM_MESSAGE_STATS];//event counts, indexed by MessageStat
+  uint32_t bytesOut;//bytes sent, including re-sent messages
+  uint32_t bytesIn;//bytes received
+  uint16_t failures[NUM_FAILURE_REASONS];//failed sends, indexed by result bit
+  uint16_t latencies[NUM_LATENCY_BUCKETS];//request-to-response histogram
+}CodeStats;
+
+//----------LOCAL VARIABLES----------
+static CodeStats codeStats[STATS_NUM_CODES];
+static uint8_t maxQueueDepth[NUM_QUEUES];//highest number of queued messages
+static uint32_t smoothedRtt = 0;//latest smoothed round trip time
+static uint32_t resendTimeout = 0;//latest re-send timeout
+
+//short names for AppMessageResult bits
+static const char * failureNames[NUM_FAILURE_REASONS] = {
+  [1] = "timeout",
+  [2] = "rejected",
+  [3] = "not connected",
+  [4] = "not running",
+  [5] = "invalid args",
+  [6] = "busy",
+  [7] = "overflow",
+  [12] = "no memory",
+  [13] = "closed",
+  [14] = "internal",
+  [15] = "invalid state"
+};
+
+//short names for MessageStat values
+static const char * statNames[NUM_MESSAGE_STATS] = {
+  "q","m","s","r","d","in"
+};
+
+//----------STATIC FUNCTION DECLARATIONS----------
+static CodeStats * get_code_stats(int code);
+  //Gets the statistics slot for a message code
+static bool code_has_stats(CodeStats * stats);
+  //Checks if a message code's statistics have anything to show
+
+//----------PUBLIC FUNCTIONS----------
+/**
+*Counts a messaging event
+*@param stat the event type
+*@param code the message code of the message involved
+*/
+void stats_count(MessageStat stat, int code){
+  CodeStats * stats = get_code_stats(code);
+  if(stats->counts[stat] < UINT16_MAX) stats->counts[stat]++;
+}
+
+/**
+*Adds to the count of bytes sent or received
+*@param outgoing true for bytes sent, false for bytes received
+*@param code the message code of the message involved
+*@param bytes the serialized message size
+*/
+void stats_add_bytes(bool outgoing, int code, uint16_t bytes){
+  CodeStats * stats = get_code_stats(code);
+  if(outgoing) stats->bytesOut += bytes;
+  else stats->bytesIn += bytes;
+}
+
+/**
+*Counts a failed message send
+*@param code the message code of the message that failed
+*@param reason the failure reason
+*/
+void stats_count_failure(int code, AppMessageResult reason){
+  CodeStats * stats = get_code_stats(code);
+  for(int i = 0; i < NUM_FAILURE_REASONS; i++){
+    if((reason & (1 << i)) && stats->failures[i] < UINT16_MAX) stats->failures[i]++;
+  }
+}
+
+/**
+*Updates the high-water mark for a message queue
+*@param queue the message queue index
+*@param depth the number of messages in the queue
+*/
+void stats_queue_depth(int queue, int depth){
+  if(queue < 0 || queue >= NUM_QUEUES) return;
+  if(depth > maxQueueDepth[queue]) maxQueueDepth[queue] = depth;
+}
+
+/**
+*Adds a request-to-response time to a message code's latency histogram
+*@param code the message code of the request
+*@param latency the time between a request and its response, in ms
+*/
+void stats_add_latency(int code, uint32_t latency){
+  CodeStats * stats = get_code_stats(code);
+  int bucket = 0;
+  uint32_t limit = FIRST_LATENCY_BUCKET;
+  while(latency >= limit && bucket < NUM_LATENCY_BUCKETS - 1){
+    bucket++;
+    limit *= 2;
+  }
+  if(stats->latencies[bucket] < UINT16_MAX) stats->latencies[bucket]++;
+}
+
+/**
+*Records the current round trip time estimate
+*@param srtt the smoothed round trip time, in ms
+*@param rto the re-send timeout, in ms
+*/
+void stats_set_rtt(uint32_t srtt, uint32_t rto){
+  smoothedRtt = srtt;
+  resendTimeout = rto;
+}
+
+/**
+*Resets all statistics to zero
+*/
+void stats_reset(){
+  memset(codeStats, 0, sizeof(codeStats));
+  memset(maxQueueDepth, 0, sizeof(maxQueueDepth));
+}
+
+/**
+*Writes a readable summary of all statistics
+*@param buffer the destination buffer
+*@param size the buffer size in bytes
+*/
+void stats_print(char * buffer, size_t size){
+  if(buffer == NULL || size == 0) return;
+  buffer[0] = '\0';
+  int offset = 0;
+  STATS_APPEND("RTT %dms, RTO %dms\n", (int) smoothedRtt, (int) resendTimeout);
+  STATS_APPEND("Max queued: %d/%d\n", maxQueueDepth[0], maxQueueDepth[1]);
+  for(int code = 0; code < STATS_NUM_CODES; code++){
+    CodeStats * stats = &codeStats[code];
+    if(!code_has_stats(stats)) continue;
+    STATS_APPEND("Code %d:", code);
+    for(int stat = 0; stat < NUM_MESSAGE_STATS; stat++){
+      if(stats->counts[stat] > 0)
+        STATS_APPEND(" %s%d", statNames[stat], stats->counts[stat]);
+    }
+    STATS_APPEND("\n %dB out, %dB in\n", (int) stats->bytesOut, (int) stats->bytesIn);
+    for(int i = 0; i < NUM_FAILURE_REASONS; i++){
+      if(stats->failures[i] == 0) continue;
+      if(failureNames[i] != NULL)
+        STATS_APPEND(" Failed, %s: %d\n", failureNames[i], stats->failures[i]);
+      else STATS_APPEND(" Failed, %d: %d\n", 1 << i, stats->failures[i]);
+    }
+    //only buckets with responses are shown, each labeled with its upper limit
+    bool anyLatency = false;
+    uint32_t limit = FIRST_LATENCY_BUCKET;
+    for(int i = 0; i < NUM_LATENCY_BUCKETS; i++, limit *= 2){
+      if(stats->latencies[i] == 0) continue;
+      if(!anyLatency) STATS_APPEND(" Latency:");
+      anyLatency = true;
+      if(i < NUM_LATENCY_BUCKETS - 1)
+        STATS_APPEND(" <%dms %d", (int) limit, stats->latencies[i]);
+      else STATS_APPEND(" more %d", stats->latencies[i]);
+    }
+    if(anyLatency) STATS_APPEND("\n");
+  }
+}
+
+/**
+*Writes all statistics to the app log
+*/
+void stats_log(){
+  char * buffer = malloc(STATS_LOG_BUFFER_SIZE);
+  if(buffer == NULL){
+    APP_LOG(APP_LOG_LEVEL_ERROR,"stats_log:not enough memory to log stats");
+    return;
+  }
+  stats_print(buffer, STATS_LOG_BUFFER_SIZE);
+  //log one line at a time to stay under the log message limit
+  char * line = buffer;
+  while(line != NULL && *line != '\0'){
+    char * lineEnd = strchr(line, '\n');
+    if(lineEnd != NULL) *lineEnd = '\0';
+    APP_LOG(APP_LOG_LEVEL_INFO,"stats:%s",line);
+    line = (lineEnd != NULL) ? lineEnd + 1 : NULL;
+  }
+  free(buffer);
+}
+
+//----------STATIC FUNCTIONS----------
+/**
+*Gets the statistics slot for a message code
+*@param code a message code
+*@return the code's statistics, or the last slot if the code is out of range
+*/
+static CodeStats * get_code_stats(int code){
+  if(code < 0 || code >= STATS_NUM_CODES) code = STATS_NUM_CODES - 1;
+  return &codeStats[code];
+}
+
+/**
+*Checks if a message code's statistics have anything to show
+*@param stats a message code's statistics
+*@return true if any count, byte total, failure, or latency is non-zero
+*/
+static bool code_has_stats(CodeStats * stats){
+  static const CodeStats empty;
+  return memcmp(stats, &empty, sizeof(CodeStats)) != 0;
+}
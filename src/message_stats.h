@@ -0,0 +1,86 @@
+#pragma once
+/**
+*@File message_stats.h
+*Collects messaging statistics, so throughput can be
+*tuned on real hardware
+*/
+#include <pebble.h>
+
+#define STATS_NUM_CODES 13 //Message codes tracked separately, higher codes share the last slot
+
+//Counted events for outgoing and incoming messages
+typedef enum{
+  STAT_QUEUED,
+    //outgoing message added to the queue
+  STAT_MERGED,
+    //outgoing message merged into a queued message
+  STAT_SENT,
+    //outgoing message delivered to the phone
+  STAT_RETRIED,
+    //outgoing message sent again
+  STAT_DROPPED,
+    //outgoing message rejected, dropped, or cancelled
+  STAT_RECEIVED,
+    //incoming message received
+  NUM_MESSAGE_STATS
+}MessageStat;
+
+/**
+*Counts a messaging event
+*@param stat the event type
+*@param code the message code of the message involved
+*/
+void stats_count(MessageStat stat, int code);
+
+/**
+*Adds to the count of bytes sent or received
+*@param outgoing true for bytes sent, false for bytes received
+*@param code the message code of the message involved
+*@param bytes the serialized message size
+*/
+void stats_add_bytes(bool outgoing, int code, uint16_t bytes);
+
+/**
+*Counts a failed message send
+*@param code the message code of the message that failed
+*@param reason the failure reason
+*/
+void stats_count_failure(int code, AppMessageResult reason);
+
+/**
+*Updates the high-water mark for a message queue
+*@param queue the message queue index
+*@param depth the number of messages in the queue
+*/
+void stats_queue_depth(int queue, int depth);
+
+/**
+*Adds a request-to-response time to a message code's latency histogram
+*@param code the message code of the request
+*@param latency the time between a request and its response, in ms
+*/
+void stats_add_latency(int code, uint32_t latency);
+
+/**
+*Records the current round trip time estimate
+*@param srtt the smoothed round trip time, in ms
+*@param rto the re-send timeout, in ms
+*/
+void stats_set_rtt(uint32_t srtt, uint32_t rto);
+
+/**
+*Resets all statistics to zero
+*/
+void stats_reset();
+
+/**
+*Writes a readable summary of all statistics
+*@param buffer the destination buffer
+*@param size the buffer size in bytes
+*/
+void stats_print(char * buffer, size_t size);
+
+/**
+*Writes all statistics to the app log
+*/
+void stats_log();
@@ -2,37 +2,154 @@
 #include "messaging_core.h"
 #include "util.h"
 #include "debug.h"
+#include "message_stats.h"
+#include "heap_budget.h"
+#include "src/message_keys.auto.h"
 
 //----------LOCAL VALUE DEFINITIONS----------
 //#define DEBUG_MESSAGING //Uncomment to enable messaging debug logging
 
-#define RESEND_TIME 60000 //Time to wait before assuming an outgoing message was lost
+#define RTO_INITIAL 1000 //Re-send timeout used before any round trip is measured
+#define RTO_MIN 250 //Shortest allowed re-send timeout
+#define RTO_MAX 60000 //Longest allowed re-send timeout, even after backoff
+//Re-send timeouts are estimated from measured round trip times
+//as in RFC 6298.  The smoothed RTT is stored multiplied by 8 and the
+//RTT variation multiplied by 4, so the update gains are simple shifts.
+#define SRTT_SHIFT 3
+#define RTTVAR_SHIFT 2
 
-//----------MESSAGE STACK STRUCTURE----------
+#define INTERACTIVE_RING_SIZE 256 //Bytes reserved for queued user actions
+#define BACKGROUND_RING_SIZE 1024 //Bytes reserved for queued content requests
 
-typedef struct msgStack{
-  uint8_t buffer[PEBBLE_DICT_SIZE];//Message dictionary buffer
-  struct msgStack * next;//Link to the next message
-}MessageStack;
+#define DEFAULT_BACKGROUND_CAPACITY 10 //Default number of background messages held at once
+
+#define MAX_INTERACTIVE_STREAK 4
+//Maximum number of interactive messages sent in a row while background
+//messages are waiting
+
+#define RING_WRAP_MARKER 0xFFFF
+//Message size value marking the point where the ring continues from offset 0
+
+#define BURST_IDLE_TIMEOUT 1500
+//Time in ms after the last bulk message before the radio returns to its
+//normal sniff interval.  Messages with a message class are content requests,
+//so they count as bulk traffic, and so do responses received during a burst.
+
+#define ALL_MESSAGE_CLASSES 0xFF //matches every message class when removing messages
+
+#define MESSAGE_CODE_KEY KEY_MESSAGE_CODE //Dictionary key holding each message's code, used for statistics
+#define FRAME_KEY KEY_FRAME //Key of binary response frames, which carry their code instead
+#define FRAME_CODE_OFFSET 1 //Offset of the message code in a binary frame, see message_handler.c
+
+#define MESSAGE_FLAG_REMOVED 0x01
+//Message header flag marking a message that was replaced or removed
+//while waiting in the queue
+
+//----------MESSAGE RING STRUCTURE----------
+//Queued messages are stored back to back in a static byte ring, each one
+//a MessageHeader followed by its serialized dictionary.  A message is never
+//split across the end of the buffer, so it can always be read in one piece.
+typedef struct{
+  uint16_t size;//Serialized dictionary size, or RING_WRAP_MARKER
+  uint8_t flags;//Message state flags
+  uint8_t messageClass;//Message class used for cancelling, or MESSAGE_CLASS_NONE
+  uint32_t mergeKey;//Messages with the same non-zero key replace each other
+}MessageHeader;
+
+typedef struct{
+  uint8_t * buffer;//Message storage
+  uint16_t capacity;//Size of the message storage buffer
+  uint16_t head;//Offset of the oldest message
+  uint16_t tail;//Offset where the next message will be written
+  uint8_t count;//Number of queued messages
+  uint8_t maxQueued;//Most messages the queue holds before applying its policy
+  QueuePolicy policy;//How the queue handles new messages when full
+}MessageRing;
+
+//A message being written straight into free ring space by begin_message.
+//Nothing in the ring changes until end_message commits it.
+typedef struct{
+  bool active;//true between begin_message and end_message
+  MessagePriority lane;//queue the message is written to
+  uint16_t offset;//ring offset reserved for the message header
+  uint8_t messageClass;//class used to cancel the message
+  uint32_t mergeKey;//key shared by messages that replace each other
+  DictionaryIterator iter;//writes the message into the ring
+}MessageBuilder;
 
 //----------LOCAL VARIABLES----------
-MessageStack * messageStack = NULL; //Unsent message stack
-int messageStackSize = 0;//Number of messages on the stack
+static uint8_t interactiveBuffer[INTERACTIVE_RING_SIZE];
+static uint8_t backgroundBuffer[BACKGROUND_RING_SIZE];
+static MessageRing outboxes[NUM_MESSAGE_PRIORITIES] = { //Unsent message queues
+  [MESSAGE_PRIORITY_INTERACTIVE] = {.buffer = interactiveBuffer,.capacity = INTERACTIVE_RING_SIZE,
+                                    .policy = QUEUE_NEVER_DROP},
+  [MESSAGE_PRIORITY_BACKGROUND] = {.buffer = backgroundBuffer,.capacity = BACKGROUND_RING_SIZE,
+                                   .maxQueued = DEFAULT_BACKGROUND_CAPACITY,.policy = QUEUE_REJECT_NEW}
+};
+static MessageBuilder builder;//message currently being written
 bool init = false;//Equals 1 iff messaging_init has been run
+uint32_t inboxSize = 0;//size of the open AppMessage inbox
 
 bool sendingMessage = false;//tracks the state of the message sending process
+MessagePriority sendingLane = MESSAGE_PRIORITY_INTERACTIVE;//queue holding the message being sent
+int interactiveStreak = 0;//interactive messages sent since the last background message
 AppTimer * resend_timer = NULL;//Time until an ignored message should be re-sent
+uint32_t smoothedRtt = 0;//smoothed round trip time in ms << SRTT_SHIFT, 0 if not yet measured
+uint32_t rttVariation = 0;//round trip time variation in ms << RTTVAR_SHIFT
+uint32_t retransmitTimeout = RTO_INITIAL;//current base re-send timeout in ms
+uint32_t sendTime = 0;//time the current message was first sent
+uint8_t sendAttempts = 0;//number of times sending the current message has been tried
 bool sendingEnabled = true;//Whether messages should be sent or saved
+bool burstMode = false;//true while the reduced sniff interval is in use
+AppTimer * burst_timer = NULL;//Time until burst mode ends if bulk traffic stops
 
 InboxHandler inbox_handler = NULL;//Function incoming messages are handed off to
 
 //----------STATIC FUNCTION DECLARATIONS----------
+static uint16_t ring_reserve(MessageRing * ring, uint16_t * offset);
+  //Finds free space for a new message, returns the most dictionary bytes it can hold
+static void ring_commit(MessageRing * ring, uint16_t offset, uint16_t size,
+                        uint8_t messageClass, uint32_t mergeKey);
+  //Adds a message written at a reserved offset to the end of the ring
+static uint16_t ring_read_header(MessageRing * ring, uint16_t offset, MessageHeader * header);
+  //Reads the header of the message at an offset, following the wrap marker if needed
+static uint8_t * ring_peek(MessageRing * ring, uint16_t * size);
+  //Gets the oldest message in the ring and its size, or NULL if the ring is empty
+static void ring_pop(MessageRing * ring);
+  //Removes the oldest message from the ring
+static void ring_clear(MessageRing * ring);
+  //Removes every message from the ring
+static int get_message_code(const uint8_t * data, uint16_t size);
+  //Reads the message code from a serialized message, for statistics
+static bool merge_message(MessagePriority lane, const uint8_t * data, uint16_t size,
+                          uint8_t messageClass, uint32_t mergeKey, MessageQueueResult * result);
+  //Merges a new message into a queued message with the same merge key
+static int remove_queued_messages(MessagePriority lane, uint8_t messageClass);
+  //Removes messages in a queue that aren't currently being sent
+static MessagePriority select_lane();
+  //Chooses the queue the next message should be sent from
+static int count_queued(MessagePriority lane);
+  //Counts messages in a queue that haven't been removed
+static bool make_room(MessagePriority lane);
+  //Applies a queue's drop policy if the queue is full
+static bool bulk_traffic_waiting();
+  //Checks if any bulk messages are queued or being sent
+static void start_burst();
+  //Switches the radio to the reduced sniff interval, or extends the current burst
+static void end_burst(void * data);
+  //Returns the radio to the normal sniff interval once bulk traffic stops
+static void app_connection_handler(bool connected);
+  //Automatically called when the phone app connects or disconnects
 static void delete_message();
   //Removes the first message in the queue
 static void send_message();
   //Sends the first message in the queue
 static void resend_message(void * data);
   //Re-sends an ignored message 
+static void update_rtt(uint32_t rtt);
+  //Updates the re-send timeout with a new round trip time measurement
+static uint32_t get_resend_delay();
+  //Gets the re-send delay for the current message, including backoff
 static void inbox_received_callback(DictionaryIterator *iterator, void *context);
   //Automatically called whenever a message is recieved
 static void inbox_dropped_callback(AppMessageResult reason, void *context);
@@ -51,8 +168,19 @@ void open_messaging(){
   app_message_register_inbox_dropped(inbox_dropped_callback);
   app_message_register_outbox_failed(outbox_failed_callback);
   app_message_register_outbox_sent(outbox_sent_callback);
-  // Open AppMessage
-  app_message_open(JS_DICT_SIZE,PEBBLE_DICT_SIZE);
+  //Hold queued messages while disconnected, and send them on reconnection
+  connection_service_subscribe((ConnectionHandlers){
+    .pebble_app_connection_handler = app_connection_handler
+  });
+  // Open AppMessage with the largest inbox this platform can spare,
+  // keeping both buffers inside the messaging heap budget
+  inboxSize = app_message_inbox_size_maximum();
+  if(inboxSize > JS_DICT_SIZE) inboxSize = JS_DICT_SIZE;
+  size_t quota = budget_get_quota(BUDGET_MESSAGES);
+  if(quota >= 2 * PEBBLE_DICT_SIZE && inboxSize > quota - PEBBLE_DICT_SIZE)
+    inboxSize = quota - PEBBLE_DICT_SIZE;
+  app_message_open(inboxSize,PEBBLE_DICT_SIZE);
+  budget_charge(BUDGET_MESSAGES, inboxSize + PEBBLE_DICT_SIZE);
   init = true;
 }
 
@@ -61,7 +189,15 @@ void close_messaging(){
   if(init){
     //delete remaining messages
     delete_all_messages();
+    if(burst_timer != NULL){
+      app_timer_cancel(burst_timer);
+      burst_timer = NULL;
+    }
+    if(burstMode) app_comm_set_sniff_interval(SNIFF_INTERVAL_NORMAL);
+    burstMode = false;
     app_message_deregister_callbacks();
+    connection_service_unsubscribe();
+    budget_release(BUDGET_MESSAGES, inboxSize + PEBBLE_DICT_SIZE);
   }
   init = false;
 }
@@ -70,14 +206,15 @@ void close_messaging(){
 *Removes all existing messages from the message queue
 */
 void delete_all_messages(){
-  while(messageStack != NULL){
-      delete_message();
-    }
+  for(int i = 0; i < NUM_MESSAGE_PRIORITIES; i++) ring_clear(&outboxes[i]);
+  interactiveStreak = 0;
   if(resend_timer != NULL){
     app_timer_cancel(resend_timer);
     resend_timer = NULL;
   }
   sendingMessage = false;
+  sendAttempts = 0;
+  builder.active = false;
 }
 
 /**
@@ -97,44 +234,129 @@ void register_inbox_handler(InboxHandler handler){
 }
 
 /**
-*adds a new message to the queue
-*param dictBuf a dictionary buffer containing the new message
+*Checks if messaging is open
+*@return true iff open_messaging has run since messaging was last closed
 */
-void add_message(uint8_t dictBuf[PEBBLE_DICT_SIZE]){
-  if(!connection_service_peek_pebble_app_connection()) return;//disable messaging if not connected
+bool is_messaging_open(){
+  return init;
+}
+
+/**
+*Gets the size of the AppMessage inbox
+*@return the inbox size in bytes, or 0 if messaging isn't open
+*/
+uint32_t get_inbox_size(){
+  return init ? inboxSize : 0;
+}
+
+/**
+*Starts a new message, reserving the largest free space in its queue
+*and writing the dictionary straight into it.  Messages added while the
+*phone is disconnected are held until it reconnects.
+*@param priority the queue the message is added to
+*@param messageClass the class used to cancel the message, or MESSAGE_CLASS_NONE
+*@param mergeKey identifies messages that make each other redundant,
+*or MESSAGE_NO_MERGE
+*@return an iterator to write the message with, or NULL if the
+*queue has no free space
+*/
+DictionaryIterator * begin_message(MessagePriority priority, uint8_t messageClass,
+                                   uint32_t mergeKey){
   if(!init)open_messaging();
-  if(messageStackSize > 10){
-    #ifdef DEBUG_MESSAGING
-    APP_LOG(APP_LOG_LEVEL_ERROR,"add_message:Too many messages! Deleting old messages");
-    #endif
-    while(messageStackSize >0) delete_message();
+  builder.active = false;
+  uint16_t space = ring_reserve(&outboxes[priority], &builder.offset);
+  if(space < dict_calc_buffer_size(1, sizeof(int8_t))){
+    APP_LOG(APP_LOG_LEVEL_ERROR,"begin_message:Outbox is full!");
+    return NULL;
   }
+  builder.active = true;
+  builder.lane = priority;
+  builder.messageClass = messageClass;
+  builder.mergeKey = mergeKey;
+  uint8_t * data = outboxes[priority].buffer + builder.offset + sizeof(MessageHeader);
+  dict_write_begin(&builder.iter, data, space);
+  return &builder.iter;
+}
+
+/**
+*Adds the message started by begin_message to the queue
+*@return whether the message was queued, merged, or rejected
+*/
+MessageQueueResult end_message(){
+  if(!builder.active) return MESSAGE_REJECTED;
+  builder.active = false;
+  MessagePriority priority = builder.lane;
+  MessageRing * outbox = &outboxes[priority];
+  uint8_t * data = outbox->buffer + builder.offset + sizeof(MessageHeader);
+  uint16_t size = dict_write_end(&builder.iter);
   #ifdef DEBUG_MESSAGING
-    APP_LOG(APP_LOG_LEVEL_DEBUG,"add_message:New message content:");
+    APP_LOG(APP_LOG_LEVEL_DEBUG,"end_message:New message content:");
     DictionaryIterator read;
-    dict_read_begin_from_buffer(&read, dictBuf, PEBBLE_DICT_SIZE);
+    dict_read_begin_from_buffer(&read, data, size);
     debugDictionary(&read);
   #endif
   
-  MessageStack ** index = &messageStack;
-  while(*index != NULL){
-    index = &((*index)->next);
+  MessageQueueResult result = MESSAGE_QUEUED;
+  if(builder.mergeKey != MESSAGE_NO_MERGE &&
+     merge_message(priority, data, size, builder.messageClass, builder.mergeKey, &result)){
+    #ifdef DEBUG_MESSAGING
+      APP_LOG(APP_LOG_LEVEL_DEBUG,"end_message:Merged message into queue, result=%d",result);
+    #endif
+    stats_count(result == MESSAGE_MERGED ? STAT_MERGED : STAT_DROPPED,
+                get_message_code(data, size));
+    if(builder.messageClass != MESSAGE_CLASS_NONE) start_burst();
+    return result;
   }
-  //allocate message
-  *index = malloc(sizeof(MessageStack));
-  if(*index == NULL){
-    APP_LOG(APP_LOG_LEVEL_ERROR,"add_message:Out of memory!");
-    return;
+  //a message replacing a queued one doesn't need any more room
+  if(result != MESSAGE_MERGED && !make_room(priority)){
+    #ifdef DEBUG_MESSAGING
+    APP_LOG(APP_LOG_LEVEL_ERROR,"end_message:Too many messages! Rejecting new message");
+    #endif
+    stats_count(STAT_DROPPED, get_message_code(data, size));
+    return MESSAGE_REJECTED;
   }
-  //copy over dictionary buffer
-  memcpy((*index)->buffer, dictBuf, PEBBLE_DICT_SIZE);
-  (*index)->next = NULL;
-  messageStackSize++;
+  ring_commit(outbox, builder.offset, size, builder.messageClass, builder.mergeKey);
+  stats_count(result == MESSAGE_MERGED ? STAT_MERGED : STAT_QUEUED, get_message_code(data, size));
+  stats_queue_depth(priority, count_queued(priority));
   #ifdef DEBUG_MESSAGING
-    APP_LOG(APP_LOG_LEVEL_DEBUG,"add_message:Added message to queue");
+    APP_LOG(APP_LOG_LEVEL_DEBUG,"end_message:Added message to queue");
   #endif
+  if(builder.messageClass != MESSAGE_CLASS_NONE) start_burst();
   //Send the message now, if message sending isn't already in progress
   if(!sendingMessage) send_message();
+  return result;
+}
+
+/**
+*Sets how many messages a queue holds, and what happens to
+*new messages once it's full
+*@param priority the message queue to configure
+*@param capacity the most messages the queue will hold, ignored
+*by QUEUE_NEVER_DROP
+*@param policy the queue's overflow policy
+*/
+void set_queue_policy(MessagePriority priority, uint8_t capacity, QueuePolicy policy){
+  outboxes[priority].maxQueued = capacity;
+  outboxes[priority].policy = policy;
+}
+
+/**
+*Cancels all queued messages of one class.  A message that's already
+*being sent can't be recalled, so it's left alone.
+*@param messageClass the class of messages to cancel
+*@return the number of messages removed from the queues
+*/
+int cancel_messages(uint8_t messageClass){
+  if(!init || messageClass == MESSAGE_CLASS_NONE) return 0;
+  int removed = 0;
+  for(int i = 0; i < NUM_MESSAGE_PRIORITIES; i++){
+    removed += remove_queued_messages(i, messageClass);
+  }
+  #ifdef DEBUG_MESSAGING
+    APP_LOG(APP_LOG_LEVEL_DEBUG,"cancel_messages:Cancelled %d messages of class %d",
+            removed, messageClass);
+  #endif
+  return removed;
 }
 
 /**
@@ -149,63 +371,53 @@ static void send_message(){
     return;//disable messaging if not connected
   } 
   if(!init)open_messaging();
-  if(messageStack == NULL)return;
+  //keep re-sending the same message until it's received
+  if(!sendingMessage) sendingLane = select_lane();
+  uint16_t messageSize;
+  uint8_t * message = ring_peek(&outboxes[sendingLane], &messageSize);
+  if(message == NULL)return;
+  if(!sendingMessage){
+    if(sendingLane == MESSAGE_PRIORITY_INTERACTIVE) interactiveStreak++;
+    else interactiveStreak = 0;
+  }
   sendingMessage = true;
   #ifdef DEBUG_MESSAGING
     APP_LOG(APP_LOG_LEVEL_DEBUG,"send_message:Retrieved message from queue");
   #endif
-  DictionaryIterator read,*send;
-  app_message_outbox_begin(&send);
-  #ifdef DEBUG_MESSAGING
-    APP_LOG(APP_LOG_LEVEL_DEBUG,"send_message:Copying message data");
-  #endif
-  Tuple * dictItem = dict_read_begin_from_buffer(&read, messageStack->buffer, PEBBLE_DICT_SIZE);
-  while(dictItem != NULL && dictItem->length > 0){
-    uint32_t key = dictItem->key;
-    uint16_t size = dictItem->length;
-    switch(dictItem->type){
-      case TUPLE_BYTE_ARRAY:
-        #ifdef DEBUG_MESSAGING
-          APP_LOG(APP_LOG_LEVEL_DEBUG,"send_message:Writing byte array for key %d",(int)key);
-        #endif
-        dict_write_data(send,key,dictItem->value->data,size);
-        break;
-      case TUPLE_CSTRING:
-        #ifdef DEBUG_MESSAGING
-          APP_LOG(APP_LOG_LEVEL_DEBUG,"send_message:Writing string %s for key %d"
-                       ,dictItem->value->cstring,(int)key);
-        #endif
-        dict_write_cstring(send, key, dictItem->value->cstring);
-        break;
-      case TUPLE_UINT:
-      {
-        uint32_t val = dictItem->value->uint32;
-        #ifdef DEBUG_MESSAGING
-          APP_LOG(APP_LOG_LEVEL_DEBUG,"send_message:Writing int for key %d",(int)key);
-        #endif
-        dict_write_int(send,key,(int *)&val,size,false);
-        break;
-      }
-      case TUPLE_INT:
-      {
-        #ifdef DEBUG_MESSAGING
-          APP_LOG(APP_LOG_LEVEL_DEBUG,"send_message:Writing int for key %d",(int)key);
-        #endif
-        int32_t val = dictItem->value->int32;
-        dict_write_int(send,key,(int *)&val,size,true);
-      }   
-    }
-    dictItem = dict_read_next(&read);
+  DictionaryIterator *send;
+  AppMessageResult result = app_message_outbox_begin(&send);
+  if(result == APP_MSG_OK){
+    //messages are queued in their final serialized form, and never exceed
+    //the PEBBLE_DICT_SIZE outbox, so the whole dictionary is copied at once
+    memcpy(send->dictionary, message, messageSize);
+    send->cursor = (Tuple *)((uint8_t *) send->dictionary + messageSize);
+    dict_write_end(send);
+    #ifdef DEBUG_MESSAGING
+      APP_LOG(APP_LOG_LEVEL_DEBUG,"send_message:Sending message");
+      debugDictionary(send);
+    #endif
+    result = app_message_outbox_send();
+  }
+  int code = get_message_code(message, messageSize);
+  if(result == APP_MSG_OK){
+    if(sendAttempts == 0) sendTime = getTimeMs();
+    if(sendAttempts < UINT8_MAX) sendAttempts++;
+    stats_add_bytes(true, code, messageSize);
+    if(sendAttempts > 1) stats_count(STAT_RETRIED, code);
+  }
+  else{
+    #ifdef DEBUG_MESSAGING
+    APP_LOG(APP_LOG_LEVEL_ERROR,"send_message:Failed to send the message");
+    log_result_info(result);
+    #endif
+    //count the failed attempt too, so a busy outbox is retried with backoff
+    //instead of every base timeout
+    if(sendAttempts < UINT8_MAX) sendAttempts++;
+    stats_count_failure(code, result);
   }
-  
-  #ifdef DEBUG_MESSAGING
-    APP_LOG(APP_LOG_LEVEL_DEBUG,"send_message:Sending message");
-    debugDictionary(&read);
-  #endif
-  app_message_outbox_send();
   //Set a timer to re-send the message if it is ignored
   if(resend_timer == NULL)
-    resend_timer = app_timer_register(RESEND_TIME,resend_message,NULL);
+    resend_timer = app_timer_register(get_resend_delay(),resend_message,NULL);
 }
 
 /**
@@ -213,17 +425,361 @@ static void send_message(){
 */
 static void delete_message(){
   if(!init)open_messaging();
-  if(messageStack != NULL){
-    MessageStack * old = messageStack;
-    messageStack = messageStack->next;
-    free(old);
-    messageStackSize--;
+  if(outboxes[sendingLane].count > 0){
+    ring_pop(&outboxes[sendingLane]);
     #ifdef DEBUG_MESSAGING
       APP_LOG(APP_LOG_LEVEL_DEBUG,"delete_message:old message deleted");
     #endif
   }
 }
 
+/**
+*Finds free space for a new message without changing the ring.  The space
+*at the end of the buffer is used if it can hold a full outbox message,
+*otherwise whichever of the end and start of the buffer is larger.
+*@param ring the message ring
+*@param offset set to the offset reserved for the message header
+*@return the most dictionary bytes that fit in the reserved space,
+*up to PEBBLE_DICT_SIZE, or 0 if the ring is full
+*/
+static uint16_t ring_reserve(MessageRing * ring, uint16_t * offset){
+  uint16_t tail = ring->count > 0 ? ring->tail : 0;
+  uint16_t space;
+  *offset = tail;
+  if(ring->count == 0 || ring->tail > ring->head){
+    //free space runs from tail to the buffer end, then from 0 to head.
+    //The tail is never allowed to catch up to the head, so tail == head
+    //always means the ring is empty
+    space = ring->capacity - tail;
+    uint16_t startSpace = ring->count > 0 && ring->head > 0 ? ring->head - 1 : 0;
+    if(space < sizeof(MessageHeader) + PEBBLE_DICT_SIZE && startSpace > space){
+      space = startSpace;
+      *offset = 0;
+    }
+  }
+  //ring has wrapped, free space runs from tail to head
+  else space = ring->head - ring->tail - 1;
+  if(space <= sizeof(MessageHeader)) return 0;
+  space -= sizeof(MessageHeader);
+  return space < PEBBLE_DICT_SIZE ? space : PEBBLE_DICT_SIZE;
+}
+
+/**
+*Adds a message written at a reserved offset to the end of the ring
+*@param ring the message ring
+*@param offset the offset returned by ring_reserve
+*@param size number of dictionary bytes written after the header
+*@param messageClass the message class
+*@param mergeKey the message merge key
+*/
+static void ring_commit(MessageRing * ring, uint16_t offset, uint16_t size,
+                        uint8_t messageClass, uint32_t mergeKey){
+  //the ring may have emptied since the space was reserved
+  if(ring->count == 0) ring->head = offset;
+  else if(offset < ring->tail &&
+          (size_t)(ring->capacity - ring->tail) >= sizeof(MessageHeader)){
+    //the message went to the start of the buffer, mark the wrap point
+    MessageHeader wrap = {.size = RING_WRAP_MARKER};
+    memcpy(ring->buffer + ring->tail, &wrap, sizeof(MessageHeader));
+  }
+  MessageHeader header = {.size = size,.flags = 0,.messageClass = messageClass,.mergeKey = mergeKey};
+  memcpy(ring->buffer + offset, &header, sizeof(MessageHeader));
+  ring->tail = offset + sizeof(MessageHeader) + size;
+  ring->count++;
+}
+
+/**
+*Reads the header of the message at an offset
+*@param ring the message ring
+*@param offset a message offset, or the offset of the wrap point
+*@param header set to the message header
+*@return the offset of the message that was read, which is 0
+*if the original offset was the wrap point
+*/
+static uint16_t ring_read_header(MessageRing * ring, uint16_t offset, MessageHeader * header){
+  if((size_t)(ring->capacity - offset) >= sizeof(MessageHeader)){
+    memcpy(header, ring->buffer + offset, sizeof(MessageHeader));
+    if(header->size != RING_WRAP_MARKER) return offset;
+  }
+  memcpy(header, ring->buffer, sizeof(MessageHeader));
+  return 0;
+}
+
+/**
+*Gets the oldest message in the ring, discarding any replaced
+*messages in front of it
+*@param ring the message ring
+*@param size set to the message size
+*@return a pointer to the serialized message, or NULL if
+*the ring is empty
+*/
+static uint8_t * ring_peek(MessageRing * ring, uint16_t * size){
+  while(ring->count > 0){
+    MessageHeader header;
+    ring->head = ring_read_header(ring, ring->head, &header);
+    if(!(header.flags & MESSAGE_FLAG_REMOVED)){
+      *size = header.size;
+      return ring->buffer + ring->head + sizeof(MessageHeader);
+    }
+    ring->head += sizeof(MessageHeader) + header.size;
+    ring->count--;
+  }
+  ring_clear(ring);
+  return NULL;
+}
+
+/**
+*Removes the oldest message from the ring
+*@param ring the message ring
+*/
+static void ring_pop(MessageRing * ring){
+  uint16_t size;
+  if(ring_peek(ring, &size) == NULL) return;
+  ring->head += sizeof(MessageHeader) + size;
+  ring->count--;
+  if(ring->count == 0) ring_clear(ring);
+}
+
+/**
+*Removes every message from the ring
+*@param ring the message ring
+*/
+static void ring_clear(MessageRing * ring){
+  ring->head = 0;
+  ring->tail = 0;
+  ring->count = 0;
+}
+
+/**
+*Reads the message code from a serialized message
+*@param data the serialized dictionary
+*@param size number of bytes in data
+*@return the message code, or -1 if the message has none
+*/
+static int get_message_code(const uint8_t * data, uint16_t size){
+  DictionaryIterator read;
+  if(dict_read_begin_from_buffer(&read, data, size) == NULL) return -1;
+  Tuple * codeTuple = dict_find(&read, MESSAGE_CODE_KEY);
+  if(codeTuple == NULL){
+    //binary frames hold their message code in the frame header
+    Tuple * frameTuple = dict_find(&read, FRAME_KEY);
+    if(frameTuple == NULL || frameTuple->length <= FRAME_CODE_OFFSET) return -1;
+    return frameTuple->value->data[FRAME_CODE_OFFSET];
+  }
+  //outgoing codes are written as int8, the phone sends int32
+  switch(codeTuple->length){
+    case 1:
+      return codeTuple->value->int8;
+    case 2:
+      return codeTuple->value->int16;
+    case 4:
+      return codeTuple->value->int32;
+  }
+  return -1;
+}
+
+/**
+*Merges a new message into a queued message with the same merge key.
+*A queued message the same size as the new one is overwritten in place,
+*otherwise the old one is marked as replaced, and the new message still
+*needs to be committed to the end of the queue.
+*@param data the new serialized dictionary
+*@param size number of bytes in data
+*@param messageClass the new message's class
+*@param mergeKey the new message's merge key
+*@param result set to MESSAGE_MERGED if the message was merged or replaces
+*a queued message
+*@return true if the new message was merged or is already being sent,
+*false if it still needs to be added to the queue
+*/
+static bool merge_message(MessagePriority lane, const uint8_t * data, uint16_t size,
+                          uint8_t messageClass, uint32_t mergeKey, MessageQueueResult * result){
+  MessageRing * outbox = &outboxes[lane];
+  uint16_t offset = outbox->head;
+  for(int i = 0; i < outbox->count; i++){
+    MessageHeader header;
+    offset = ring_read_header(outbox, offset, &header);
+    uint8_t * message = outbox->buffer + offset + sizeof(MessageHeader);
+    if(!(header.flags & MESSAGE_FLAG_REMOVED) && header.mergeKey == mergeKey){
+      //the first message may already be in the outbox, so it can't be changed
+      if(i == 0 && sendingMessage && lane == sendingLane){
+        if(header.size == size && memcmp(message, data, size) == 0){
+          *result = MESSAGE_MERGED;
+          return true;
+        }
+      }
+      else if(header.size == size){
+        memcpy(message, data, size);
+        header.messageClass = messageClass;
+        memcpy(outbox->buffer + offset, &header, sizeof(MessageHeader));
+        *result = MESSAGE_MERGED;
+        return true;
+      }
+      else{
+        header.flags |= MESSAGE_FLAG_REMOVED;
+        memcpy(outbox->buffer + offset, &header, sizeof(MessageHeader));
+        *result = MESSAGE_MERGED;
+        return false;
+      }
+    }
+    offset += sizeof(MessageHeader) + header.size;
+  }
+  return false;
+}
+
+/**
+*Removes messages in a queue that aren't currently being sent
+*@param lane the message queue to search
+*@param messageClass the class of messages to remove, or ALL_MESSAGE_CLASSES
+*@return the number of messages removed
+*/
+static int remove_queued_messages(MessagePriority lane, uint8_t messageClass){
+  MessageRing * outbox = &outboxes[lane];
+  uint16_t offset = outbox->head;
+  int removed = 0;
+  for(int i = 0; i < outbox->count; i++){
+    MessageHeader header;
+    offset = ring_read_header(outbox, offset, &header);
+    if(!(header.flags & MESSAGE_FLAG_REMOVED) &&
+       (messageClass == ALL_MESSAGE_CLASSES || header.messageClass == messageClass) &&
+       (i > 0 || !sendingMessage || lane != sendingLane)){
+      header.flags |= MESSAGE_FLAG_REMOVED;
+      memcpy(outbox->buffer + offset, &header, sizeof(MessageHeader));
+      stats_count(STAT_DROPPED, get_message_code(outbox->buffer + offset + sizeof(MessageHeader),
+                                                 header.size));
+      removed++;
+    }
+    offset += sizeof(MessageHeader) + header.size;
+  }
+  //drop removed messages from the front of the queue right away
+  uint16_t size;
+  ring_peek(outbox, &size);
+  return removed;
+}
+
+/**
+*Chooses the queue the next message should be sent from.  Interactive
+*messages always go first, except that a background message is sent
+*after every MAX_INTERACTIVE_STREAK interactive messages so background
+*requests still make progress.
+*@return the selected message queue
+*/
+static MessagePriority select_lane(){
+  //drop removed messages first, so only queues with real messages count
+  uint16_t size;
+  for(int i = 0; i < NUM_MESSAGE_PRIORITIES; i++) ring_peek(&outboxes[i], &size);
+  bool interactiveWaiting = outboxes[MESSAGE_PRIORITY_INTERACTIVE].count > 0;
+  bool backgroundWaiting = outboxes[MESSAGE_PRIORITY_BACKGROUND].count > 0;
+  if(interactiveWaiting &&
+     (!backgroundWaiting || interactiveStreak < MAX_INTERACTIVE_STREAK))
+    return MESSAGE_PRIORITY_INTERACTIVE;
+  if(backgroundWaiting) return MESSAGE_PRIORITY_BACKGROUND;
+  return MESSAGE_PRIORITY_INTERACTIVE;
+}
+
+/**
+*Counts messages in a queue that haven't been removed
+*@param lane the message queue
+*@return the number of messages waiting to be sent, including
+*any message currently being sent
+*/
+static int count_queued(MessagePriority lane){
+  MessageRing * outbox = &outboxes[lane];
+  uint16_t offset = outbox->head;
+  int queued = 0;
+  for(int i = 0; i < outbox->count; i++){
+    MessageHeader header;
+    offset = ring_read_header(outbox, offset, &header);
+    if(!(header.flags & MESSAGE_FLAG_REMOVED)) queued++;
+    offset += sizeof(MessageHeader) + header.size;
+  }
+  return queued;
+}
+
+/**
+*Applies a queue's overflow policy if the queue is full
+*@param lane the message queue
+*@return true if the queue has room for a new message
+*/
+static bool make_room(MessagePriority lane){
+  MessageRing * outbox = &outboxes[lane];
+  if(outbox->policy == QUEUE_NEVER_DROP) return true;
+  if(count_queued(lane) < outbox->maxQueued) return true;
+  if(outbox->policy == QUEUE_REJECT_NEW) return false;
+  //QUEUE_DROP_OLDEST: remove the oldest message that isn't being sent
+  uint16_t offset = outbox->head;
+  for(int i = 0; i < outbox->count; i++){
+    MessageHeader header;
+    offset = ring_read_header(outbox, offset, &header);
+    if(!(header.flags & MESSAGE_FLAG_REMOVED) &&
+       (i > 0 || !sendingMessage || lane != sendingLane)){
+      header.flags |= MESSAGE_FLAG_REMOVED;
+      memcpy(outbox->buffer + offset, &header, sizeof(MessageHeader));
+      stats_count(STAT_DROPPED, get_message_code(outbox->buffer + offset + sizeof(MessageHeader),
+                                                 header.size));
+      uint16_t size;
+      ring_peek(outbox, &size);
+      return true;
+    }
+    offset += sizeof(MessageHeader) + header.size;
+  }
+  return false;
+}
+
+/**
+*Checks if any bulk messages are queued or being sent
+*@return true if a message with a message class is waiting in any queue
+*/
+static bool bulk_traffic_waiting(){
+  for(int lane = 0; lane < NUM_MESSAGE_PRIORITIES; lane++){
+    MessageRing * outbox = &outboxes[lane];
+    uint16_t offset = outbox->head;
+    for(int i = 0; i < outbox->count; i++){
+      MessageHeader header;
+      offset = ring_read_header(outbox, offset, &header);
+      if(!(header.flags & MESSAGE_FLAG_REMOVED) && header.messageClass != MESSAGE_CLASS_NONE)
+        return true;
+      offset += sizeof(MessageHeader) + header.size;
+    }
+  }
+  return false;
+}
+
+/**
+*Switches the radio to the reduced sniff interval, so bulk transfers
+*aren't limited by Bluetooth latency, and restarts the idle timeout
+*/
+static void start_burst(){
+  if(!burstMode){
+    #ifdef DEBUG_MESSAGING
+      APP_LOG(APP_LOG_LEVEL_DEBUG,"start_burst:Reducing sniff interval");
+    #endif
+    app_comm_set_sniff_interval(SNIFF_INTERVAL_REDUCED);
+    burstMode = true;
+  }
+  if(burst_timer == NULL)
+    burst_timer = app_timer_register(BURST_IDLE_TIMEOUT, end_burst, NULL);
+  else app_timer_reschedule(burst_timer, BURST_IDLE_TIMEOUT);
+}
+
+/**
+*Returns the radio to the normal sniff interval, unless bulk
+*messages are still waiting to be sent
+*@param data unused callback data
+*/
+static void end_burst(void * data){
+  burst_timer = NULL;
+  if(bulk_traffic_waiting()){
+    burst_timer = app_timer_register(BURST_IDLE_TIMEOUT, end_burst, NULL);
+    return;
+  }
+  #ifdef DEBUG_MESSAGING
+    APP_LOG(APP_LOG_LEVEL_DEBUG,"end_burst:Restoring normal sniff interval");
+  #endif
+  app_comm_set_sniff_interval(SNIFF_INTERVAL_NORMAL);
+  burstMode = false;
+}
+
 /**
 *Re-sends an ignored message 
 *@param data: unused callback data
@@ -232,6 +788,43 @@ static void resend_message(void * data){
   resend_timer = NULL;
   send_message();
 }
+
+/**
+*Updates the smoothed round trip time estimate and the re-send
+*timeout with a new measurement
+*@param rtt the measured round trip time in milliseconds
+*/
+static void update_rtt(uint32_t rtt){
+  if(smoothedRtt == 0){
+    smoothedRtt = (rtt << SRTT_SHIFT) | 1;//keep non-zero once measured
+    rttVariation = (rtt / 2) << RTTVAR_SHIFT;
+  }
+  else{
+    int32_t error = (int32_t) rtt - (int32_t)(smoothedRtt >> SRTT_SHIFT);
+    smoothedRtt += error;//srtt += error/8
+    if(error < 0) error = -error;
+    rttVariation += error - (rttVariation >> RTTVAR_SHIFT);//rttvar += (|error| - rttvar)/4
+  }
+  retransmitTimeout = (smoothedRtt >> SRTT_SHIFT) + rttVariation;//srtt + 4*rttvar
+  if(retransmitTimeout < RTO_MIN) retransmitTimeout = RTO_MIN;
+  if(retransmitTimeout > RTO_MAX) retransmitTimeout = RTO_MAX;
+  stats_set_rtt(smoothedRtt >> SRTT_SHIFT, retransmitTimeout);
+  #ifdef DEBUG_MESSAGING
+  APP_LOG(APP_LOG_LEVEL_DEBUG,"update_rtt:rtt=%d srtt=%d rto=%d",(int) rtt,
+          (int)(smoothedRtt >> SRTT_SHIFT),(int) retransmitTimeout);
+  #endif
+}
+
+/**
+*Gets the time to wait before re-sending the current message.  The
+*timeout doubles with each attempt, up to RTO_MAX.
+*@return the re-send delay in milliseconds
+*/
+static uint32_t get_resend_delay(){
+  uint32_t delay = retransmitTimeout;
+  for(int i = 1; i < sendAttempts && delay < RTO_MAX; i++) delay *= 2;
+  return delay < RTO_MAX ? delay : RTO_MAX;
+}
   
 /**
 *Automatically called whenever a message is recieved
@@ -245,6 +838,12 @@ static void inbox_received_callback(DictionaryIterator *iterator, void *context)
   APP_LOG(APP_LOG_LEVEL_DEBUG,"inbox_received_callback:Received message content:");
   debugDictionary(iterator);
   #endif
+  uint16_t size = (uint8_t *) iterator->end - (uint8_t *) iterator->dictionary;
+  int code = get_message_code((uint8_t *) iterator->dictionary, size);
+  stats_count(STAT_RECEIVED, code);
+  stats_add_bytes(false, code, size);
+  //responses to bulk requests keep the burst going
+  if(burstMode) start_burst();
   //pass message to the message handler
   if(inbox_handler != NULL)inbox_handler(iterator);  
 }
@@ -273,9 +872,13 @@ static void outbox_failed_callback(DictionaryIterator *iterator, AppMessageResul
   APP_LOG(APP_LOG_LEVEL_ERROR, "outbox_failed_callback:Outbox send failed");
   log_result_info(reason);
   #endif
-  //reset timer to give Android more time to receive the message before re-sending
+  //the failed message is still first in its queue
+  uint16_t messageSize;
+  uint8_t * message = ring_peek(&outboxes[sendingLane], &messageSize);
+  stats_count_failure(message != NULL ? get_message_code(message, messageSize) : -1, reason);
+  //restart the timer so the message is re-sent after the backed-off timeout
   if(resend_timer != NULL){
-    app_timer_reschedule(resend_timer, RESEND_TIME);
+    app_timer_reschedule(resend_timer, get_resend_delay());
   }
 }
 
@@ -291,12 +894,37 @@ static void outbox_sent_callback(DictionaryIterator *iterator, void *context) {
   #endif
   app_timer_cancel(resend_timer);
   resend_timer = NULL;//cancel re-send timer
+  //only measure messages sent once, since a re-sent message's
+  //acknowledgement can't be matched to a specific attempt
+  if(sendAttempts == 1) update_rtt(getTimeMs() - sendTime);
+  sendAttempts = 0;
+  uint16_t messageSize;
+  uint8_t * message = ring_peek(&outboxes[sendingLane], &messageSize);
+  if(message != NULL) stats_count(STAT_SENT, get_message_code(message, messageSize));
   delete_message();//delete successfully sent message
   sendingMessage = false;
   send_message();//send the next message in the queue, if there is one
 }
 
 
+/**
+*Automatically called when the phone app connects or disconnects
+*@param connected true if the phone app is now connected
+*@post on reconnection, held messages are sent in order
+*/
+static void app_connection_handler(bool connected){
+  #ifdef DEBUG_MESSAGING
+  APP_LOG(APP_LOG_LEVEL_INFO,"app_connection_handler:connected=%d",(int) connected);
+  #endif
+  if(!connected) return;
+  //don't wait out a re-send timeout that was set before disconnecting
+  if(resend_timer != NULL){
+    app_timer_cancel(resend_timer);
+    resend_timer = NULL;
+  }
+  send_message();
+}
+
 /**
 *Given an error appMessageResult, prints debug data explaining the result
 *@param result the message result
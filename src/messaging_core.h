@@ -7,9 +7,40 @@
 #include <pebble.h>
 
 #define PEBBLE_DICT_SIZE 128
-#define JS_DICT_SIZE 2048//AppMessage dictionary size
+#define JS_DICT_SIZE PBL_IF_COLOR_ELSE(4096,2048)//Largest AppMessage inbox size to open
+#define MESSAGE_NO_MERGE 0//Merge key for messages that should never be merged
+#define MESSAGE_CLASS_NONE 0//Message class for small messages that are never cancelled
 typedef void (* InboxHandler)(DictionaryIterator *iterator);
 
+//Outgoing message priority classes, each with its own queue
+typedef enum{
+  MESSAGE_PRIORITY_INTERACTIVE,
+    //user actions, sent ahead of everything else
+  MESSAGE_PRIORITY_BACKGROUND,
+    //content requests and prefetching
+  NUM_MESSAGE_PRIORITIES
+}MessagePriority;
+
+//Results of adding a message to the queue
+typedef enum{
+  MESSAGE_QUEUED,
+    //added to the end of the queue
+  MESSAGE_MERGED,
+    //replaced a queued message with the same merge key
+  MESSAGE_REJECTED
+    //the queue is full, try again later
+}MessageQueueResult;
+
+//Ways a full message queue handles new messages
+typedef enum{
+  QUEUE_DROP_OLDEST,
+    //remove the oldest queued message that isn't being sent
+  QUEUE_REJECT_NEW,
+    //refuse new messages until there's room
+  QUEUE_NEVER_DROP
+    //ignore the capacity, only refuse messages when out of space
+}QueuePolicy;
+
 /**
 *Initialize messaging and open AppMessage
 */
@@ -40,9 +71,58 @@ void toggle_message_sending(bool send_messages);
 void register_inbox_handler(InboxHandler handler);
 
 /**
-*Adds a message to the outbox queue, to
-*be sent soon
-*@param dictBuf a dictionary message buffer to
-*be copied
+*Checks if messaging is open
+*@return true iff open_messaging has run since messaging was last closed
+*/
+bool is_messaging_open();
+
+/**
+*Gets the size of the AppMessage inbox
+*@return the inbox size in bytes, or 0 if messaging isn't open
+*/
+uint32_t get_inbox_size();
+
+/**
+*Starts a new message, written directly into free space in the
+*outbox queue.  Only one message is built at a time, and it isn't
+*queued until end_message is called.  Messages with a message class
+*are treated as bulk content requests: the radio uses a reduced sniff
+*interval until they're sent and their responses stop arriving.
+*@param priority the message's priority class
+*@param messageClass an application-defined class used
+*to cancel the message, or MESSAGE_CLASS_NONE
+*@param mergeKey a key shared by messages that make
+*each other redundant, or MESSAGE_NO_MERGE
+*@return an iterator to write the message with, or NULL
+*if the queue has no free space
+*/
+DictionaryIterator * begin_message(MessagePriority priority, uint8_t messageClass,
+                                   uint32_t mergeKey);
+
+/**
+*Adds the message started by begin_message to the outbox
+*queue, to be sent soon.  If a queued message has the same
+*merge key, the new message replaces it instead.
+*@return MESSAGE_REJECTED if the queue is full, so the
+*caller should back off and retry later
+*/
+MessageQueueResult end_message();
+
+/**
+*Sets how many messages a queue holds, and what happens to
+*new messages once it's full.  By default interactive messages
+*are never dropped, and the background queue rejects new
+*messages after 10 are waiting.
+*@param priority the message queue to configure
+*@param capacity the most messages the queue will hold
+*@param policy the queue's overflow policy
+*/
+void set_queue_policy(MessagePriority priority, uint8_t capacity, QueuePolicy policy);
+
+/**
+*Removes all queued messages of one class.  A message
+*that's already being sent is left alone.
+*@param messageClass the class of messages to cancel
+*@return the number of messages removed
 */
-void add_message(uint8_t dictBuf[PEBBLE_DICT_SIZE]);
+int cancel_messages(uint8_t messageClass);
@@ -28,6 +28,14 @@ void notify_window_load(Window * window);
 void notify_window_appear(Window * window);
 void notify_window_disappear(Window * window);
 void notify_window_unload(Window * window);
+static void handle_op_failed(InboxMessage * message);
+static void handle_op_succeeded(InboxMessage * message);
+
+//Registers handlers for operation result messages from javascript
+void register_notify_handlers(){
+  register_message_handler(CODE_OP_FAILED, handle_op_failed);
+  register_message_handler(CODE_OP_SUCCEEDED, handle_op_succeeded);
+}
 
 //Shows a new notification screen
 void show_notification(char * notifyMsg, int duration, GColor bgColor, NotifyCallbacks nCallbacks){
@@ -170,3 +178,35 @@ void reloadList(){
   destroy_page_menu();
 }
 
+//Message handlers:
+
+//Shows the reason an operation failed, closing any view the failure affects
+static void handle_op_failed(InboxMessage * message){
+  NOTIFY_DEBUG("handle_op_failed: operation %d failed, %s",message->op,message->text);
+  if(message->text == NULL) return;
+  NotifyCallbacks failCallbacks = {0};
+  int duration = 3;
+  switch((OpCode) message->op){
+    case OP_LOGIN:
+      failCallbacks.onSuddenClose = closeApp;
+      duration = -1;
+      break;
+    case OP_LOAD_PAGES:
+      failCallbacks.onSuddenClose = closeList;
+      break;
+    case OP_LOAD_TEXT:
+      failCallbacks.onSuddenClose = closeText;
+      break;
+    default:
+      break;
+  }
+  show_notification(message->text, duration, GColorRed, failCallbacks);
+}
+
+//Shows the result of a successful operation
+static void handle_op_succeeded(InboxMessage * message){
+  NOTIFY_DEBUG("handle_op_succeeded: %s",message->text);
+  if(message->text == NULL) return;
+  show_notification(message->text, 3, GColorGreen,
+                   (NotifyCallbacks){.onDisappear = hide_notification});
+}
@@ -36,6 +36,11 @@ void show_notification(char * notifyMsg, int duration, GColor bgColor, NotifyCal
 */
 void hide_notification();
 
+/**
+*Registers handlers for operation result messages from javascript
+*/
+void register_notify_handlers();
+
 //Predefined callbacks:
 
 //Closes any pageView window
@@ -5,6 +5,7 @@
 #include "notify.h"
 #include "storage_keys.h"
 #include "drawing.h"
+#include "stats_view.h"
 
 //----------LOCAL VALUE DEFINITIONS----------
 //#define OPTIONS_DEBUG_ENABLED//comment out to disable menu debug logs
@@ -45,6 +46,7 @@ typedef enum{
   OPTIONS_DISPLAY_SETTINGS,
   #ifndef PBL_ROUND
   OPTIONS_TOGGLE_PAGING,
+  OPTIONS_TOGGLE_LINE_RENDERER,
   #endif
   OPTIONS_CLEAR_DATA,
 }MainOptions;
@@ -53,6 +55,7 @@ static char * mainOptionsText [] = {
   "Display settings",
   #ifndef PBL_ROUND
   "Enable paging",
+  "Draw only visible lines",
   #endif
   "Clear saved data",
 };
@@ -164,6 +167,7 @@ static int menuContext = 1;
 OptionMenuType currentMenu = OPTIONS_MENU_MAIN;
 
 static bool pagingEnabled = false;
+static bool lineRendererEnabled = false;
 //selected colors
 GColor selectedColors []= {
   {GColorWhiteARGB8},
@@ -264,6 +268,8 @@ static void drawRow
   (GContext *ctx, const Layer *cell_layer, MenuIndex *cell_index, void *callback_context);
 static void selectClick
   (struct MenuLayer *menu_layer, MenuIndex *cell_index, void *callback_context);
+static void selectLongClick
+  (struct MenuLayer *menu_layer, MenuIndex *cell_index, void *callback_context);
 static void selectionWillChange
   (struct MenuLayer *menu_layer, MenuIndex *new_index, MenuIndex old_index, void *callback_context);
 //submenu specific click callback handlers
@@ -305,6 +311,7 @@ void init_options(){
     selectedColors[OPTIONS_SELECTED_TEXT_COLOR].argb = persist_read_int(PERSIST_KEY_TEXT_SELECTION_COLOR);
   #ifndef PBL_ROUND
   pagingEnabled = persist_read_bool(PERSIST_KEY_ENABLE_PAGING);
+  lineRendererEnabled = persist_read_bool(PERSIST_KEY_ENABLE_LINE_RENDERER);
   #endif
   //load text attributes
   if(textAttr == NULL)textAttr = graphics_text_attributes_create();
@@ -339,6 +346,7 @@ void destroy_options(){
   persist_write_int(PERSIST_KEY_BG_SELECTION_COLOR, selectedColors[OPTIONS_SELECTED_BG_COLOR].argb);
   persist_write_int(PERSIST_KEY_TEXT_SELECTION_COLOR, selectedColors[OPTIONS_SELECTED_TEXT_COLOR].argb);
   persist_write_bool(PERSIST_KEY_ENABLE_PAGING,pagingEnabled);
+  persist_write_bool(PERSIST_KEY_ENABLE_LINE_RENDERER,lineRendererEnabled);
   optionsInitialized = false;
 }
 
@@ -411,6 +419,11 @@ bool getPagingEnabled(){
   return pagingEnabled;
 }
 
+bool getLineRendererEnabled(){
+  if(!optionsInitialized)init_options();
+  return lineRendererEnabled && !getPagingEnabled();
+}
+
 
 //----------STATIC FUNCTIONS----------
 
@@ -481,7 +494,7 @@ static void options_window_create(Window * window){
       .draw_row = drawRow,
       .draw_header = NULL,
       .select_click = selectClick,
-      .select_long_click = selectClick,
+      .select_long_click = selectLongClick,
       .selection_changed = NULL,
       .selection_will_change = selectionWillChange,
       .get_separator_height = NULL
@@ -686,7 +699,8 @@ static char * getCellText(int cellIndex){
 static bool cellHasImage(int cellIndex){
   return
     #ifndef PBL_ROUND
-    (currentMenu == OPTIONS_MENU_MAIN && cellIndex == OPTIONS_TOGGLE_PAGING) ||
+    (currentMenu == OPTIONS_MENU_MAIN &&
+     (cellIndex == OPTIONS_TOGGLE_PAGING || cellIndex == OPTIONS_TOGGLE_LINE_RENDERER)) ||
     #endif
     currentMenu == OPTIONS_MENU_SET_COLORS ||
     currentMenu == OPTIONS_MENU_SET_FONTS;
@@ -698,6 +712,9 @@ static void drawCellImage(GContext *ctx, int cellIndex, GRect bounds){
   if (currentMenu == OPTIONS_MENU_MAIN && cellIndex == OPTIONS_TOGGLE_PAGING){
     draw_checkbox(ctx, bounds, pagingEnabled);
   }
+  if (currentMenu == OPTIONS_MENU_MAIN && cellIndex == OPTIONS_TOGGLE_LINE_RENDERER){
+    draw_checkbox(ctx, bounds, lineRendererEnabled);
+  }
   #endif
   if(currentMenu == OPTIONS_MENU_SET_COLORS){
     GColor imgColor = selectedColors[cellIndex];
@@ -794,6 +811,13 @@ static void selectClick(struct MenuLayer *menu_layer, MenuIndex *cell_index, voi
   }
 }
 
+//Callback for a long select press: opens the hidden messaging statistics
+//screen from the main menu, otherwise acts like a normal select click
+static void selectLongClick(struct MenuLayer *menu_layer, MenuIndex *cell_index, void *callback_context){
+  if(currentMenu == OPTIONS_MENU_MAIN) open_stats_view();
+  else selectClick(menu_layer, cell_index, callback_context);
+}
+
 //Select click callback for the main menu
 static void mainMenuSelectClick
   (struct MenuLayer *menu_layer, int optionsIndex, void *callback_context){
@@ -817,6 +841,10 @@ static void mainMenuSelectClick
       }
       menu_layer_reload_data(optionsMenu);
     break;
+    case OPTIONS_TOGGLE_LINE_RENDERER:
+      lineRendererEnabled = !lineRendererEnabled;
+      menu_layer_reload_data(optionsMenu);
+    break;
     #endif
   }
 }
@@ -41,3 +41,10 @@ GColor getSelectedTextColor();
 
 //true if pages should use paging, false if they use scrolling
 bool getPagingEnabled();
+
+/**
+*true if page text should be drawn by a single layer that only draws
+*the lines in view, false if each subpage gets its own text layer.
+*Only used while paging is disabled.
+*/
+bool getLineRendererEnabled();
@@ -4,6 +4,8 @@
 #include "util.h"
 #include "notify.h"
 #include "options.h"
+#include "page_view.h"
+#include "heap_budget.h"
 
 //----------LOCAL VALUE DEFINITIONS----------
 #define PAGE_MENU_DEBUG_ENABLED//comment out to disable menu debug logs
@@ -15,8 +17,8 @@
 #define PAGE_MENU_ERROR(fmt, args...) 
 #endif
 
-#define MAX_NUM_TITLES 20 //maximum number of pages to hold at one time
 #define TITLE_LOAD_NUM 10 //number of new pages to request when loading more titles
+#define TITLE_RETRY_DELAY 1000 //ms to wait before retrying a rejected title request
 
 //----------PAGE MENU DATA----------
 char * pageTitles[MAX_NUM_TITLES] = {NULL}; //stores page titles
@@ -34,6 +36,10 @@ static GTextAttributes * textAttr;
 //Used to prevent duplicate requests from piling up
 static bool waitingForPages = false;
 
+//Time before which new title requests are held back, after the
+//outbox rejected a request
+static uint32_t titleRetryTime = 0;
+
 //Indicates if initial page load has occurred
 static bool pagesLoaded = false;
 
@@ -43,8 +49,11 @@ static void handle_window_unload(Window * window);
 static void handle_window_disappear(Window * window);
 static void requestNextTitles();
 static void requestPreviousTitles();
+static bool sendTitleRequest(int index, int count);
 static char * getCellText(MenuIndex *cell_index);
 static int getTitleIndex(MenuIndex *cell_index);
+static void free_title(int arrayIndex);
+static size_t evict_titles(size_t bytes);
 
 //-----MENU LAYER CALLBACKS-----
 static uint16_t getNumRows
@@ -58,7 +67,18 @@ static void selectClick
 static void selectionWillChange
   (struct MenuLayer *menu_layer, MenuIndex *new_index, MenuIndex old_index, void *callback_context);
 
+//-----MESSAGE HANDLERS-----
+static void handle_title_response(InboxMessage * message);
+static void handle_reset_page_data(InboxMessage * message);
+
 //----------PUBLIC FUNCTIONS----------
+//Registers handlers for page list messages from javascript
+void register_page_menu_handlers(){
+  register_message_handler(CODE_PAGE_TITLE_RESPONSE, handle_title_response);
+  register_message_handler(CODE_RESET_PAGE_DATA, handle_reset_page_data);
+}
+
+
 //Load a new page list menu
 void init_page_menu(void) {
   PAGE_MENU_DEBUG("init_page_menu:loading menu window");
@@ -100,6 +120,7 @@ void init_page_menu(void) {
     .selection_will_change = selectionWillChange,
     .get_separator_height = NULL
   });
+  budget_register(BUDGET_TITLES, evict_titles);
   window_stack_push(menu_window, true);
   if(!pagesLoaded){
     requestInitialTitles();
@@ -121,7 +142,7 @@ void destroy_page_menu(void) {
 
 
 //add new page titles to the menu
-void update_titles(const char * newTitleString, int firstNewIndex){
+void update_titles(const char * const titleStrings[], int titleCount, int firstNewIndex){
   if(firstNewIndex == firstTitleIndex && pagesLoaded){
     PAGE_MENU_DEBUG("update_titles:ignoring duplicate title update");
     hide_notification();
@@ -132,24 +153,24 @@ void update_titles(const char * newTitleString, int firstNewIndex){
   if(menu_window == NULL)init_page_menu();
   PAGE_MENU_DEBUG("update_titles:adding titles, newIndex=%d, oldIndex=%d",
           firstNewIndex,firstTitleIndex);
-  //break string into title strings
+  //copy title strings out of the message buffer, as many as the title
+  //budget allows
   char * newTitles[MAX_NUM_TITLES] = {NULL};
-  int strIndex = 0;
   int newTitleCount;
-  for(newTitleCount = 0; newTitleCount < MAX_NUM_TITLES; newTitleCount++){
-    size_t numChars = 0;
-    for(size_t i = strIndex; i < strlen(newTitleString); i++){
-      if(newTitleString[i] == '\n') break;
-      else numChars++;
+  for(newTitleCount = 0; newTitleCount < MAX_NUM_TITLES && newTitleCount < titleCount;
+      newTitleCount++){
+    if(titleStrings[newTitleCount] == NULL || titleStrings[newTitleCount][0] == '\0') break;
+    if(!budget_reserve(BUDGET_TITLES, strlen(titleStrings[newTitleCount]) + 1)){
+      PAGE_MENU_DEBUG("update_titles:title budget full after %d titles",newTitleCount);
+      break;
+    }
+    newTitles[newTitleCount] = malloc_strcpy(newTitles[newTitleCount], titleStrings[newTitleCount]);
+    if(newTitles[newTitleCount] == NULL){
+      budget_release(BUDGET_TITLES, strlen(titleStrings[newTitleCount]) + 1);
+      break;
     }
-    if(numChars > 0){
-      newTitles[newTitleCount] = malloc_strncpy(newTitles[newTitleCount], 
-                                                newTitleString + strIndex, 
-                                                numChars);
-      PAGE_MENU_DEBUG("update_titles:title %d set to:%s",
-              newTitleCount,newTitles[newTitleCount]);
-      strIndex += numChars + 1;
-    }else break;
+    PAGE_MENU_DEBUG("update_titles:title %d set to:%s",
+            newTitleCount,newTitles[newTitleCount]);
   }
   PAGE_MENU_DEBUG("update_titles:found %d new titles",newTitleCount);
   if(newTitleCount > numTitles)numTitles = newTitleCount;
@@ -175,11 +196,7 @@ void update_titles(const char * newTitleString, int firstNewIndex){
               MAX_NUM_TITLES - titleOffset, titleIndex);
     }else{//translate titles forward by titleOffset
       for(int i = MAX_NUM_TITLES-1; i >=0; i--){
-        if(i + titleOffset >= MAX_NUM_TITLES){
-          if(pageTitles[i] != NULL){
-            free(pageTitles[i]);
-            pageTitles[i] = NULL;
-        }}
+        if(i + titleOffset >= MAX_NUM_TITLES) free_title(i);
         else{
           pageTitles[i + titleOffset] = pageTitles[i];
           pageTitles[i] = NULL;
@@ -197,11 +214,7 @@ void update_titles(const char * newTitleString, int firstNewIndex){
               titleOffset, menuIndex.row);
     }else{//translate titles backward by titleOffset
       for(int i = 0; i < MAX_NUM_TITLES; i++){
-        if(i - titleOffset < 0){
-          if(pageTitles[i] != NULL){
-            free(pageTitles[i]);
-            pageTitles[i] = NULL;
-        }}
+        if(i - titleOffset < 0) free_title(i);
         else{
             pageTitles[i - titleOffset] = pageTitles[i];
             pageTitles[i] = NULL;
@@ -216,9 +229,8 @@ void update_titles(const char * newTitleString, int firstNewIndex){
   int startIndex = firstNewIndex-firstTitleIndex;
   for(int i = startIndex; i < newTitleCount+startIndex && i < MAX_NUM_TITLES; i++){
     if(newTitles[i - startIndex] != NULL){
-      char * oldTitle = pageTitles[i];
+      free_title(i);
       pageTitles[i] = newTitles[i - startIndex];
-      if(oldTitle != NULL) free(oldTitle);
   }}
   PAGE_MENU_DEBUG("update_titles:copied new titles");
   menu_layer_set_selected_index(titleMenu, menuIndex, MenuRowAlignCenter, false);
@@ -234,8 +246,7 @@ void update_titles(const char * newTitleString, int firstNewIndex){
 void requestInitialTitles(){
   PAGE_MENU_DEBUG("requestPreviousTitles:requesting %d titles",MAX_NUM_TITLES);
   if(!waitingForPages){
-    get_page_titles(0,MAX_NUM_TITLES);
-    waitingForPages = true;
+    waitingForPages = sendTitleRequest(0,MAX_NUM_TITLES);
     show_notification("Loading pages...", -1, getBGColor(),
                       (NotifyCallbacks){.onDisappear = hide_notification,
                                         .onSuddenClose = closeList});
@@ -247,8 +258,7 @@ void remove_title(int titleIndex){
   if(titleIndex >= firstTitleIndex &&
     titleIndex  < firstTitleIndex + numTitles){
     int arrayIndex = titleIndex - firstTitleIndex;
-    if(pageTitles[arrayIndex] != NULL)
-      free(pageTitles[arrayIndex]);
+    free_title(arrayIndex);
     for(int i = arrayIndex; i < MAX_NUM_TITLES; i++){
       if(i == MAX_NUM_TITLES) pageTitles[i] = NULL;
       else pageTitles[i] = pageTitles[i+1];
@@ -279,6 +289,7 @@ static void handle_window_disappear(Window * window){
 //window unload callback
 static void handle_window_unload(Window* window) {
   PAGE_MENU_DEBUG("handle_window_unload:destroying window contents");
+  cancel_requests(REQUEST_PAGE_TITLES);
   if(statusBar != NULL){
     status_bar_layer_destroy(statusBar);
     statusBar = NULL;
@@ -287,11 +298,7 @@ static void handle_window_unload(Window* window) {
     menu_layer_destroy(titleMenu);
     titleMenu = NULL;
   }
-  for(int i = 0; i < MAX_NUM_TITLES; i++){
-    if(pageTitles[i] != NULL){
-      free(pageTitles[i]);
-      pageTitles[i] = NULL;
-  }}
+  for(int i = 0; i < MAX_NUM_TITLES; i++) free_title(i);
   if(textAttr != NULL){
     graphics_text_attributes_destroy(textAttr);
     textAttr = NULL;
@@ -308,8 +315,7 @@ static void requestNextTitles(){
   if(!waitingForPages){
     PAGE_MENU_DEBUG("requestNextTitles:requesting %d titles at %d",
                    TITLE_LOAD_NUM,firstTitleIndex + numTitles);
-    get_page_titles(firstTitleIndex + numTitles,TITLE_LOAD_NUM);
-    waitingForPages = true;
+    waitingForPages = sendTitleRequest(firstTitleIndex + numTitles,TITLE_LOAD_NUM);
   } 
 }
 
@@ -321,14 +327,55 @@ static void requestPreviousTitles(){
                    TITLE_LOAD_NUM,firstTitleIndex - TITLE_LOAD_NUM);
     int newIndex = firstTitleIndex - TITLE_LOAD_NUM;
     if(newIndex < 0) newIndex = 0;
-    get_page_titles(newIndex,TITLE_LOAD_NUM);
-    waitingForPages = true;
+    waitingForPages = sendTitleRequest(newIndex,TITLE_LOAD_NUM);
   }
 }
 
+//Sends a title request unless the outbox recently rejected one
+//returns true if the request was sent
+static bool sendTitleRequest(int index, int count){
+  uint32_t now = getTimeMs();
+  if((int32_t)(titleRetryTime - now) > 0) return false;
+  if(get_page_titles(index,count)) return true;
+  PAGE_MENU_DEBUG("sendTitleRequest:outbox full, backing off");
+  titleRetryTime = now + TITLE_RETRY_DELAY;
+  return false;
+}
+
+
 
 
 
+//Frees a stored title and returns its memory to the title budget
+static void free_title(int arrayIndex){
+  if(pageTitles[arrayIndex] != NULL){
+    budget_release(BUDGET_TITLES, strlen(pageTitles[arrayIndex]) + 1);
+    free(pageTitles[arrayIndex]);
+    pageTitles[arrayIndex] = NULL;
+  }
+}
+
+//Frees titles from the end of the list when the heap budget needs memory,
+//keeping the selected title and the one after it.  Freed titles are
+//requested again when the list is scrolled back to them.
+//returns the number of bytes released
+static size_t evict_titles(size_t bytes){
+  if(titleMenu == NULL) return 0;
+  MenuIndex menuIndex = menu_layer_get_selected_index(titleMenu);
+  int keepCount = getTitleIndex(&menuIndex) + 2;
+  if(keepCount < 1) keepCount = 1;
+  size_t released = 0;
+  while(released < bytes && numTitles > keepCount){
+    numTitles--;
+    if(pageTitles[numTitles] != NULL) released += strlen(pageTitles[numTitles]) + 1;
+    free_title(numTitles);
+  }
+  if(released > 0){
+    PAGE_MENU_DEBUG("evict_titles:released %d bytes, %d titles left",(int) released,numTitles);
+    menu_layer_reload_data(titleMenu);
+  }
+  return released;
+}
 
 //Given a menu index, get what page title index is selected 
 static int getTitleIndex(MenuIndex *cell_index){
@@ -431,4 +478,25 @@ static void selectClick(struct MenuLayer *menu_layer, MenuIndex *cell_index, voi
 //Callback for changing menu selection
 static void selectionWillChange(struct MenuLayer *menu_layer, MenuIndex *new_index, MenuIndex old_index, void *callback_context){
 //currently does nothing
-} 
\ No newline at end of file
+} 
+
+//-----MESSAGE HANDLERS-----
+//Loads titles sent by javascript, one title per frame section
+static void handle_title_response(InboxMessage * message){
+  const char * titles[MAX_NUM_TITLES];
+  int titleCount = 0;
+  uint16_t offset = 0;
+  while(titleCount < MAX_NUM_TITLES &&
+        (titles[titleCount] = message_next_section(message, &offset)) != NULL){
+    titleCount++;
+  }
+  PAGE_MENU_DEBUG("handle_title_response:received %d titles at index %d",titleCount,message->index);
+  if(titleCount > 0) update_titles(titles, titleCount, message->index);
+}
+
+//Reloads the page list after javascript's saved pages changed
+static void handle_reset_page_data(InboxMessage * message){
+  unload_page();
+  destroy_page_menu();
+  init_page_menu();
+}
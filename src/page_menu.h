@@ -4,6 +4,8 @@
 *Handles any windows displaying a list of pocket saved pages
 */
 
+#define MAX_NUM_TITLES 20 //most page titles held at one time, the title heap budget may keep fewer
+
 /**
 *Requests the first few titles on the list
 */
@@ -19,13 +21,19 @@ void init_page_menu();
 */
 void destroy_page_menu();
 
+/**
+*Registers handlers for page list messages from javascript
+*/
+void register_page_menu_handlers();
+
 /**
 *Load new titles into the page list
 *This will initialize the page menu if necessary
-*newTitles: all new titles, separated by '\n'
+*titleStrings: the new titles, in list order
+*titleCount: number of titles in titleStrings
 *firstNewIndex: index of the first title received
 */
-void update_titles(const char * newTitles, int firstNewIndex);
+void update_titles(const char * const titleStrings[], int titleCount, int firstNewIndex);
 
 /**
 *Removes a title from the list
@@ -8,6 +8,7 @@
 #include "page_menu.h"
 #include "notify.h"
 #include "subpage.h"
+#include "heap_budget.h"
 
 //----------LOCAL VALUE DEFINITIONS----------
 //#define PAGE_DEBUG_ENABLED//comment out to disable page debug logs
@@ -19,12 +20,20 @@
 #define PAGE_ERROR(fmt, args...) 
 #endif
 
-#define SCROLL_LAYER_MAX_SIZE 25000
-//if scroll layer expands past this size, move back
-
-#define DEFAULT_SCROLL_OFFSET_CHANGE 10000
-//a good general amount to offset the scroll layers to
-//avoid overly frequent offset changes
+#define SCROLL_WINDOW_MARGIN 4
+//screen heights from either end of the scroll window where it's moved
+//to put the view back near its center
+
+//----------PREFETCH SETTINGS----------
+//Subpages are requested ahead of the one being read in the scroll
+//direction, more of them the faster the page is scrolling, and a
+//few are kept behind.  The window shrinks when the subpage heap
+//budget is nearly used up.
+#define PREFETCH_AHEAD_MAX 4 //most subpages requested ahead of the one being read
+#define PREFETCH_BEHIND 1 //subpages requested behind the one being read
+#define PREFETCH_SPEED_STEP 300 //scroll speed in pixels per second that adds another subpage ahead
+#define PREFETCH_TIMEOUT 5000 //ms to wait for requested subpages before requesting them again
+#define SCROLL_IDLE_TIME 1000 //ms without scrolling before the scroll speed resets
 
 typedef enum{
   PAGE_ARCHIVE,
@@ -38,13 +47,24 @@ static StatusBarLayer * statusBar = NULL;
 static ScrollLayer* scrollLayer = NULL;//main scrolling content
 
 bool changingScrollOffset = false; //if true, don't treat scrolling as usual
+static bool shiftingWindow = false; //true while the scroll window is moved, offset changes are ignored
 Bookmark targetMark = {-1,-1};//If changingScrollOffset, this is set to the target bookmark
 
 int totalSubpageCount = 0;//Total number of subpages available for the current page
 PageState currPageState = STATE_UNREAD; //status of the current page
 FavoriteStatus currFaveState = FAVE_FALSE;//favorite status of the current page
 bool bookmarked = false;//True if a page bookmark has been saved
-bool waitingForSubpage = false;//true if a subpage has been requested but hasn't arrived yet
+int streamLimit = 0;//javascript may push subpages below this index
+int streamedEnd = 0;//subpages before this index have arrived once, so the stream won't send them again
+int requestedEnd = 0;//subpages before this index are loaded or requested
+int requestedStart = INT16_MAX;//subpages from this index on are loaded or requested
+int loadedEnd = 0;//last_page_index() + 1 when prefetch was last updated
+int loadedStart = INT16_MAX;//first_page_index() when prefetch was last updated
+uint32_t forwardProgressTime = 0;//time requested subpages last arrived after the loaded ones
+uint32_t backwardProgressTime = 0;//time requested subpages last arrived before the loaded ones
+int scrollDirection = 1;//1 when reading forward, -1 when scrolling back
+int scrollSpeed = 0;//smoothed scroll speed in pixels per second
+uint32_t lastScrollTime = 0;//time of the last scroll update
 
 static GPoint lastOffset = {0,0};
 //----------ACTION MENU DATA----------
@@ -79,8 +99,12 @@ static void open_action_menu();
 static void close_action_menu();
 //menu action callback
 static void menuAction(ActionMenu *action_menu, const ActionMenuItem *action, void *context);
-//Moves all scroll layer content to get around scroll layer size limits
-static void offsetScrollLayer(int offset);
+//moves the scroll window near the view when the view nears its ends
+static void update_scroll_window();
+//moves the scroll window so a text y coordinate is near its center
+static void center_scroll_window(int32_t y);
+//moves the scroll window over the text, keeping the view in place
+static void shift_scroll_window(int32_t shift);
 //Save the current page and viewing location to the phone
 static void bookmarkPage();
 //scrolls to a bookmarked page location
@@ -90,16 +114,30 @@ static int getScrollLayerHeight();
 //given a scroll offset height, returns the nearest page boundary
 int getNearestPageBoundary(int scrollOffset);
 //resizes the scroll layer to fit its content
-void fit_scrollLayer_to_content();
+static void fit_scrollLayer_to_content();
+//loads page text sent by javascript
+static void handle_text_response(InboxMessage * message);
+//updates the scroll direction and speed
+static void track_scroll_speed(int distance);
+//requests subpages around the one being read
+static void update_prefetch();
+//clears prefetch state for a new page
+static void reset_prefetch();
 
 //----------PUBLIC FUNCTIONS----------
+//Registers handlers for page text messages from javascript
+void register_page_view_handlers(){
+  register_message_handler(CODE_PAGE_TEXT_RESPONSE, handle_text_response);
+}
+
+
 //Loads new page text
 void load_page_text(char * pageText,int subpageIndex,int pageSize,
                     int pageState,int faveStatus,int bookmarkOffset){
   memDebug("load_page_text: loading page text");
   if(pageText == NULL || strlen(pageText) == 0){
     PAGE_DEBUG( "load_page_text: received no text");
-    waitingForSubpage = false;
+    if(pageText != NULL) free(pageText);
     return;
   }
   totalSubpageCount = pageSize;
@@ -110,20 +148,17 @@ void load_page_text(char * pageText,int subpageIndex,int pageSize,
     window_stack_push(pageWindow, true);
   subpage_set_parent(scrollLayer);
   subpage_init(pageText,subpageIndex);
-  waitingForSubpage = false; 
+  fit_scrollLayer_to_content();
+  if(subpageIndex >= streamedEnd) streamedEnd = subpageIndex + 1;
+  if(subpageIndex == last_page_index()) forwardProgressTime = getTimeMs();
+  if(subpageIndex == first_page_index()) backwardProgressTime = getTimeMs();
   //if this is the first time the bookmarked subpage has loaded, go to the marked spot
   if(!bookmarked && bookmarkOffset != -1){
     PAGE_DEBUG("load_page_text: loading bookmark at subpage %d, %d percent",subpageIndex,bookmarkOffset);
     bookmarked = true;
     scroll_to_bookmark((Bookmark){subpageIndex, bookmarkOffset});
-    //also ask for the nearest adjacent subpage
-    waitingForSubpage = true;
-    int nearestPage = subpageIndex > 50 ? subpageIndex - 1 : subpageIndex + 1;
-    if(nearestPage >= 0 && nearestPage < pageSize){
-      PAGE_DEBUG("load_page_text:requesting nearest page, %d",nearestPage);
-      get_page_text(nearestPage);
-    }
   }
+  update_prefetch();
 }
 
 /**
@@ -178,7 +213,7 @@ static void handle_window_load(Window* window) {
   });
   layer_add_child(windowLayer,scroll_layer_get_layer(scrollLayer));
   scroll_layer_set_click_config_onto_window(scrollLayer, pageWindow);
-  scroll_layer_set_content_size(scrollLayer,GSize(0,SCROLL_LAYER_MAX_SIZE));
+  scroll_layer_set_content_size(scrollLayer,GSize(0,SCROLL_WINDOW_HEIGHT));
   scroll_layer_set_paging(scrollLayer, getPagingEnabled());
   PAGE_DEBUG("handle_window_load:window loaded");
 }
@@ -188,8 +223,9 @@ static void handle_window_load(Window* window) {
 */
 static void handle_window_unload(Window* window) {
   PAGE_DEBUG("handle_window_unload: unload starting, destroying subpages");
+  cancel_requests(REQUEST_PAGE_TEXT);
   subpage_destroy_all();
-  waitingForSubpage = false;
+  reset_prefetch();
   bookmarked = false;
   totalSubpageCount = 0;
   changingScrollOffset = false;
@@ -210,20 +246,18 @@ static void handle_window_unload(Window* window) {
 *page scrolling callback
 */
 static void scroll_layer_update(struct ScrollLayer *scroll_layer, void *context){
+  if(shiftingWindow) return;
   Bookmark currentMark = bookmark_from_parent_offset();
   GPoint offset = scroll_layer_get_content_offset(scroll_layer);
   #ifdef PAGE_DEBUG_ENABLED
-  PAGE_DEBUG("tTop:%d, offset:%d(pg%d,%d%%), tEnd:%d",
-                -get_text_top(),offset.y,currentMark.subpage,currentMark.offsetPercent,-get_text_bottom());
+  PAGE_DEBUG("tTop:%d, window:%d, offset:%d(pg%d,%d%%), tEnd:%d",(int) get_text_top(),
+             (int) subpage_window_top(),offset.y,currentMark.subpage,currentMark.offsetPercent,
+             (int) get_text_bottom());
   #endif
-  if(!changingScrollOffset && 
-     ((offset.y - lastOffset.y) > 200 || (offset.y-lastOffset.y) < -200)){
-      PAGE_DEBUG("scroll_layer_update:Offset skipped from %d to %d,resetting to last offset.",
-                 lastOffset.y,offset.y);
-    scroll_to_bookmark(bookmark_from_offset(lastOffset.y));
-    return;
-  }
+  if(!changingScrollOffset) track_scroll_speed(lastOffset.y - offset.y);
   lastOffset = offset;
+  subpage_update_residency();
+  fit_scrollLayer_to_content();
   if(changingScrollOffset){//don't make requests when scrolling to a bookmark
     //scrolling is complete if the offset isn't more than 1 percent away from expected
     int distanceFromExpected = (targetMark.subpage * 100 + targetMark.offsetPercent) -
@@ -242,90 +276,101 @@ static void scroll_layer_update(struct ScrollLayer *scroll_layer, void *context)
       changingScrollOffset = false;
     } 
   }
-  if(waitingForSubpage || changingScrollOffset){
-    PAGE_DEBUG("scroll_layer_get_content_offset:skipping, wSubpage=%d cOffset=%d",
-               waitingForSubpage,changingScrollOffset);
+  if(changingScrollOffset){
+    PAGE_DEBUG("scroll_layer_get_content_offset:skipping while scrolling to a bookmark");
     return;
   }
-  int scrollLayerHeight = getScrollLayerHeight();
-  int topBounds = scrollLayerHeight*4;
-  int bottomBounds = SCROLL_LAYER_MAX_SIZE - scrollLayerHeight*4;
-  int offsetShift = 0;
-  //if reaching layer bottom edge, translate everything up
-  if(-offset.y >= bottomBounds){
-    offsetShift = DEFAULT_SCROLL_OFFSET_CHANGE;
-    PAGE_DEBUG("scroll_layer_get_content_offset:offset=%d,reaching scroll end, translate up",-offset.y );
-  }
-  //if reaching offset zero, translate down
-  else if(-offset.y <= topBounds &&
-         (first_page_index() != 0 || get_text_top() < 0)){
-    offsetShift = -DEFAULT_SCROLL_OFFSET_CHANGE;
-    PAGE_DEBUG("scroll_layer_get_content_offset:offset=%d,reaching scroll start, translate down",-offset.y );
-  }
-  topBounds = get_text_top() + scrollLayerHeight*4;
-  bottomBounds = get_text_bottom() - scrollLayerHeight*4;
-  //if reaching the text start, translate to scrollLayer start
-  if(first_page_index() == 0 && get_text_top() != 0 &&
-    -offset.y <= topBounds){
-    PAGE_DEBUG("scroll_layer_get_content_offset:offset=%d,reaching page start, translate to scroll start",-offset.y );
-    offsetShift = get_text_top();
-  }
-  //if reaching the text end, translate to scrollLayer end
-  else if(-offset.y >= bottomBounds && 
-    last_page_index() == totalSubpageCount-1){
-    offsetShift = get_text_bottom() - SCROLL_LAYER_MAX_SIZE;
-    PAGE_DEBUG("scroll_layer_get_content_offset:offset=%d,reaching page end, translate to scroll end",-offset.y );
-  }
-  if(offsetShift != 0){
-    offsetScrollLayer(offsetShift);
-    return;
+  update_scroll_window();
+  //see if new text needs to load
+  update_prefetch();
+}
+
+
+/**
+*Moves the scroll window when the view nears either end of it and the
+*text continues past that end.  When the start of the text is near,
+*the window is lined up with it so scrolling stops at the first line.
+*/
+static void update_scroll_window(){
+  int viewHeight = getScrollLayerHeight();
+  int margin = viewHeight * SCROLL_WINDOW_MARGIN;
+  int32_t windowTop = subpage_window_top();
+  int32_t viewTop = windowTop - scroll_layer_get_content_offset(scrollLayer).y;
+  int32_t textTop = get_text_top();
+  if(first_page_index() == 0 && textTop != windowTop && viewTop - textTop < margin){
+    PAGE_DEBUG("update_scroll_window:view=%d,reaching page start, moving window to text start",(int) viewTop);
+    shift_scroll_window(textTop - windowTop);
   }
-  //if not moving scroll offset, see if new text needs to load
-  topBounds = get_text_top() + (2*scrollLayerHeight) -10;
-  bottomBounds = get_text_bottom() - (2*scrollLayerHeight) +10;
-  //if reaching end, get new text
-  if(-offset.y >= bottomBounds && 
-    last_page_index()+1 < totalSubpageCount &&
-    !waitingForSubpage){
-    waitingForSubpage = true;
-    get_page_text(last_page_index() + 1);
-    PAGE_DEBUG("scroll_layer_update:requesting page %d",last_page_index() + 1);
+  else if(viewTop - windowTop < margin &&
+         (first_page_index() != 0 || textTop < windowTop)){
+    PAGE_DEBUG("update_scroll_window:view=%d,reaching window start, moving window up",(int) viewTop);
+    center_scroll_window(viewTop);
   }
-  //if reaching beginning, get earlier text
-  else if(-offset.y <= topBounds &&
-         first_page_index() != 0 &&
-         !waitingForSubpage){
-    waitingForSubpage = true;
-    get_page_text(first_page_index() - 1);
-    PAGE_DEBUG("scroll_layer_update:requesting page %d",first_page_index() - 1);
+  else if(windowTop + SCROLL_WINDOW_HEIGHT - (viewTop + viewHeight) < margin &&
+         (last_page_index() != totalSubpageCount - 1 ||
+          get_text_bottom() > windowTop + SCROLL_WINDOW_HEIGHT)){
+    PAGE_DEBUG("update_scroll_window:view=%d,reaching window end, moving window down",(int) viewTop);
+    center_scroll_window(viewTop);
   }
 }
 
+/**
+*Moves the scroll window by whole screens so a text y coordinate is
+*near its center, unless it's already well inside the window
+*@param y a y coordinate in the text
+*/
+static void center_scroll_window(int32_t y){
+  int viewHeight = getScrollLayerHeight();
+  int margin = viewHeight * SCROLL_WINDOW_MARGIN;
+  int32_t windowY = y - subpage_window_top();
+  if(viewHeight <= 0 ||
+     (windowY >= margin && windowY + viewHeight <= SCROLL_WINDOW_HEIGHT - margin)) return;
+  //whole screens keep paged text on the same page grid
+  int32_t shift = windowY - (SCROLL_WINDOW_HEIGHT - viewHeight) / 2;
+  shift -= shift % viewHeight;
+  shift_scroll_window(shift);
+}
 
 /**
-*move scroll layer contents; allows expanding scroll layer
-*past size limits
-*offset: amount to move scroll layer offset and all scroll
-*layer contents.  NOTE: offset follows the same rules as 
-*scroll layer content offsets, where down is negative
+*Moves the scroll window over the text, and moves the scroll offset
+*the opposite way so the view stays on the same text
+*@param shift distance to move the window down the text, negative to
+*move up
 */
-static void offsetScrollLayer(int offset){
-  
-  PAGE_DEBUG("offsetScrollLayer: changing offset by %d",offset);
-  //save current page offset
-  Bookmark currentMark;
-    //if currently moving to a bookmark, save the intended destination 
-  if(changingScrollOffset)currentMark = targetMark;
-  else{
-    currentMark = bookmark_from_parent_offset();
-  }
-  //move text layers
-  subpage_translate_all(-offset);
-  //move scroll offset
-  scroll_to_bookmark(currentMark);
-  
-  GPoint soffset = scroll_layer_get_content_offset(scrollLayer);
-  PAGE_DEBUG("offsetScrollLayer complete, offset is at %d",soffset.y);
+static void shift_scroll_window(int32_t shift){
+  if(shift == 0) return;
+  PAGE_DEBUG("shift_scroll_window:moving window by %d",(int) shift);
+  int32_t viewTop = subpage_window_top() - scroll_layer_get_content_offset(scrollLayer).y;
+  shiftingWindow = true;
+  subpage_shift_window(shift);
+  fit_scrollLayer_to_content();
+  //a view left outside the window is only possible while the caller
+  //is about to scroll somewhere else
+  int32_t offset = subpage_window_top() - viewTop;
+  if(offset > 0) offset = 0;
+  if(offset < -SCROLL_WINDOW_HEIGHT) offset = -SCROLL_WINDOW_HEIGHT;
+  //only lining the window up with the text start moves it by part of a page
+  if(getPagingEnabled()) offset = getNearestPageBoundary(offset);
+  lastOffset = GPoint(0, offset);
+  scroll_layer_set_content_offset(scrollLayer, lastOffset, false);
+  shiftingWindow = false;
+}
+
+/**
+*Sets the scroll layer content height to the scroll window height, or
+*less once the end of the text is inside the window, so scrolling stops
+*at the last line
+*/
+static void fit_scrollLayer_to_content(){
+  if(scrollLayer == NULL) return;
+  int32_t contentHeight = SCROLL_WINDOW_HEIGHT;
+  int32_t textEnd = get_text_bottom() - subpage_window_top();
+  if(totalSubpageCount > 0 && last_page_index() == totalSubpageCount - 1 &&
+     textEnd < contentHeight) contentHeight = textEnd;
+  int viewHeight = getScrollLayerHeight();
+  if(contentHeight < viewHeight) contentHeight = viewHeight;
+  if(contentHeight != scroll_layer_get_content_size(scrollLayer).h)
+    scroll_layer_set_content_size(scrollLayer, GSize(0, contentHeight));
 }
 
 
@@ -333,11 +378,14 @@ static void offsetScrollLayer(int offset){
 static void scroll_to_bookmark(Bookmark dest){
   PAGE_DEBUG("scroll_to_bookmark: scrolling %d percent into subpage %d",
              dest.offsetPercent,dest.subpage);
-  GPoint scrollOffset = offset_from_bookmark(dest);
+  int32_t destY = position_from_bookmark(dest);
+  //bring the destination into the scroll window
+  center_scroll_window(destY);
+  GPoint scrollOffset = GPoint(0, subpage_window_top() - destY);
   //if paging is enabled, move bookmark to the nearest page boundary
   if(getPagingEnabled()){
     scrollOffset.y = getNearestPageBoundary(scrollOffset.y);
-    dest = bookmark_from_offset(scrollOffset.y);
+    dest = bookmark_from_position(subpage_window_top() - scrollOffset.y);
   }
   targetMark = dest;
   changingScrollOffset = true;
@@ -372,8 +420,9 @@ int getNearestPageBoundary(int scrollOffset){
   int pageFraction = scrollOffset % viewHeight;
   if(pageFraction < viewHeight/2) scrollOffset -= pageFraction;
   else scrollOffset += viewHeight - pageFraction;
+  int contentHeight = scroll_layer_get_content_size(scrollLayer).h;
   while(scrollOffset > 0) scrollOffset -= viewHeight;
-  while(scrollOffset < -SCROLL_LAYER_MAX_SIZE+viewHeight)
+  while(scrollOffset < -contentHeight+viewHeight)
     scrollOffset += viewHeight;
   
   PAGE_DEBUG("Nearest page boundary is %d",scrollOffset);
@@ -452,3 +501,115 @@ static void click_config_provider(void * context){
 static void down_single_click_handler(ClickRecognizerRef recognizer, void *context){
   open_action_menu();
 }
+
+/**
+*Loads page text sent by javascript
+*@param message the CODE_PAGE_TEXT_RESPONSE message
+*/
+static void handle_text_response(InboxMessage * message){
+  load_page_text(message_copy_text(message), message->index, message->itemCount,
+                 message->pageState, message->favorite, message->scrollOffset);
+}
+
+
+/**
+*Updates the scroll direction and smoothed scroll speed
+*@param distance pixels scrolled forward since the last update,
+*negative when scrolling back
+*/
+static void track_scroll_speed(int distance){
+  uint32_t now = getTimeMs();
+  uint32_t elapsed = now - lastScrollTime;
+  lastScrollTime = now;
+  if(distance == 0) return;
+  scrollDirection = distance > 0 ? 1 : -1;
+  if(distance < 0) distance = -distance;
+  if(elapsed >= SCROLL_IDLE_TIME){
+    scrollSpeed = 0;
+    return;
+  }
+  if(elapsed == 0) elapsed = 1;
+  int speed = distance * 1000 / (int) elapsed;
+  scrollSpeed = (scrollSpeed * 3 + speed) / 4;
+}
+
+/**
+*Requests the subpages around the one being read that aren't loaded
+*or already requested.  Subpages ahead are pushed by javascript when it
+*supports streaming, others are requested one at a time.  The stream
+*only sends each subpage once, so subpages that were unloaded after
+*arriving are requested directly.  Requests that haven't arrived after
+*PREFETCH_TIMEOUT are requested again.
+*/
+static void update_prefetch(){
+  if(totalSubpageCount == 0) return;
+  Bookmark currentMark = changingScrollOffset ? targetMark : bookmark_from_parent_offset();
+  if(currentMark.subpage < 0) return;
+  //choose the window size from the scroll speed and subpage budget
+  int ahead = 1;
+  int behind = PREFETCH_BEHIND;
+  uint32_t now = getTimeMs();
+  if(budget_is_low(BUDGET_SUBPAGES)) behind = 0;
+  else if(now - lastScrollTime < SCROLL_IDLE_TIME){
+    ahead += scrollSpeed / PREFETCH_SPEED_STEP;
+    if(ahead > PREFETCH_AHEAD_MAX) ahead = PREFETCH_AHEAD_MAX;
+  }
+  int forwardEnd = currentMark.subpage + 1 + (scrollDirection > 0 ? ahead : behind);
+  if(forwardEnd > totalSubpageCount) forwardEnd = totalSubpageCount;
+  int backwardStart = currentMark.subpage - (scrollDirection > 0 ? behind : ahead);
+  if(backwardStart < 0) backwardStart = 0;
+  //subpages unloaded to make room have to be requested again
+  int lastEnd = last_page_index() + 1;
+  int firstStart = first_page_index();
+  if(lastEnd < loadedEnd) requestedEnd = lastEnd;
+  if(firstStart > loadedStart) requestedStart = firstStart;
+  loadedEnd = lastEnd;
+  loadedStart = firstStart;
+  //forget requests that haven't arrived after PREFETCH_TIMEOUT
+  bool forwardStalled = requestedEnd > lastEnd && now - forwardProgressTime > PREFETCH_TIMEOUT;
+  bool backwardStalled = requestedStart < firstStart && now - backwardProgressTime > PREFETCH_TIMEOUT;
+  if(forwardStalled || requestedEnd < lastEnd) requestedEnd = lastEnd;
+  if(backwardStalled || requestedStart > firstStart) requestedStart = firstStart;
+  if(requestedEnd < forwardEnd){
+    if(forwardStalled || requestedEnd == lastEnd) forwardProgressTime = now;
+    //the stream never sends a subpage twice, so ones it already sent are requested directly
+    while(requestedEnd < forwardEnd && requestedEnd < streamedEnd && get_page_text(requestedEnd)){
+      PAGE_DEBUG("update_prefetch:requesting page %d again",requestedEnd);
+      requestedEnd++;
+    }
+  }
+  if(requestedEnd < forwardEnd && requestedEnd >= streamedEnd){
+    //after a stall, request text directly in case the stream stopped
+    if(!forwardStalled && (streamLimit >= forwardEnd || grant_text_credits(forwardEnd))){
+      PAGE_DEBUG("update_prefetch:streaming subpages up to %d",forwardEnd);
+      if(forwardEnd > streamLimit) streamLimit = forwardEnd;
+      requestedEnd = forwardEnd;
+    }
+    //if the outbox is full, the request is retried on the next scroll
+    else while(requestedEnd < forwardEnd && get_page_text(requestedEnd)){
+      PAGE_DEBUG("update_prefetch:requesting page %d",requestedEnd);
+      requestedEnd++;
+    }
+  }
+  if(requestedStart > backwardStart){
+    if(backwardStalled || requestedStart == firstStart) backwardProgressTime = now;
+    while(requestedStart > backwardStart && get_page_text(requestedStart - 1)){
+      PAGE_DEBUG("update_prefetch:requesting page %d",requestedStart - 1);
+      requestedStart--;
+    }
+  }
+}
+
+/**
+*Clears prefetch and scroll speed state for a new page
+*/
+static void reset_prefetch(){
+  streamLimit = 0;
+  streamedEnd = 0;
+  requestedEnd = 0;
+  requestedStart = INT16_MAX;
+  loadedEnd = 0;
+  loadedStart = INT16_MAX;
+  scrollDirection = 1;
+  scrollSpeed = 0;
+}
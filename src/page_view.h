@@ -1,7 +1,8 @@
 #pragma once
 /**
 *Loads new page text
-*pageText: the new page text
+*pageText: the new page text, allocated with malloc.  The page view
+*takes ownership of the text and frees it when it's no longer needed.
 *subpageIndex: index of the section of the page being sent
 *pageSize:total number of subpages available
 *pageState:enum PageState value, enum defined in message_handler.h
@@ -25,3 +26,8 @@ void init_page();
 */
 void unload_page();
 
+/**
+*Registers handlers for page text messages from javascript
+*/
+void register_page_view_handlers();
+
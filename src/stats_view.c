@@ -0,0 +1,137 @@
+#include <pebble.h>
+#include "stats_view.h"
+#include "message_stats.h"
+#include "notify.h"
+#include "options.h"
+
+//----------LOCAL VALUE DEFINITIONS----------
+#define STATS_TEXT_SIZE 2048 //Buffer size for the statistics text
+#define STATS_TEXT_MAX_HEIGHT 2000 //Tallest allowed statistics text layer
+#define STATS_MARGIN 4 //Space between the text and the screen edge
+
+//----------LOCAL VARIABLES----------
+static Window * statsWindow = NULL;
+static ScrollLayer * statsScroll = NULL;
+static TextLayer * statsText = NULL;
+static char * statsBuffer = NULL;//statistics text
+
+//----------STATIC FUNCTION DECLARATIONS----------
+static void stats_window_load(Window * window);
+  //Creates the statistics layers
+static void stats_window_unload(Window * window);
+  //Destroys the statistics layers and window
+static void update_stats_text();
+  //Reprints the statistics and resizes the text to fit
+static void click_config_provider(void * context);
+  //Sets up select button handlers, in addition to scrolling
+static void select_click(ClickRecognizerRef recognizer, void * context);
+  //Writes the statistics to the app log
+static void select_long_click(ClickRecognizerRef recognizer, void * context);
+  //Resets the statistics
+
+//----------PUBLIC FUNCTIONS----------
+//Opens the messaging statistics screen
+void open_stats_view(){
+  if(statsWindow != NULL) return;
+  statsBuffer = malloc(STATS_TEXT_SIZE);
+  if(statsBuffer == NULL){
+    APP_LOG(APP_LOG_LEVEL_ERROR,"open_stats_view:not enough memory to show stats");
+    return;
+  }
+  statsWindow = window_create();
+  window_set_background_color(statsWindow, getBGColor());
+  window_set_window_handlers(statsWindow, (WindowHandlers){
+    .load = stats_window_load,
+    .unload = stats_window_unload
+  });
+  window_stack_push(statsWindow, true);
+}
+
+//----------STATIC FUNCTIONS----------
+/**
+*Creates the statistics layers
+*@param window the statistics window
+*/
+static void stats_window_load(Window * window){
+  Layer * windowLayer = window_get_root_layer(window);
+  GRect bounds = layer_get_bounds(windowLayer);
+  statsScroll = scroll_layer_create(bounds);
+  scroll_layer_set_callbacks(statsScroll, (ScrollLayerCallbacks){
+    .click_config_provider = click_config_provider
+  });
+  scroll_layer_set_click_config_onto_window(statsScroll, window);
+  statsText = text_layer_create(GRect(STATS_MARGIN, 0, bounds.size.w - 2 * STATS_MARGIN,
+                                      STATS_TEXT_MAX_HEIGHT));
+  text_layer_set_font(statsText, fonts_get_system_font(FONT_KEY_GOTHIC_14));
+  text_layer_set_background_color(statsText, GColorClear);
+  text_layer_set_text_color(statsText, getTextColor());
+  text_layer_set_overflow_mode(statsText, GTextOverflowModeWordWrap);
+  scroll_layer_add_child(statsScroll, text_layer_get_layer(statsText));
+  layer_add_child(windowLayer, scroll_layer_get_layer(statsScroll));
+  update_stats_text();
+}
+
+/**
+*Destroys the statistics layers and window
+*@param window the statistics window
+*/
+static void stats_window_unload(Window * window){
+  if(statsText != NULL){
+    text_layer_destroy(statsText);
+    statsText = NULL;
+  }
+  if(statsScroll != NULL){
+    scroll_layer_destroy(statsScroll);
+    statsScroll = NULL;
+  }
+  if(statsBuffer != NULL){
+    free(statsBuffer);
+    statsBuffer = NULL;
+  }
+  window_destroy(statsWindow);
+  statsWindow = NULL;
+}
+
+/**
+*Reprints the statistics and resizes the text to fit
+*/
+static void update_stats_text(){
+  stats_print(statsBuffer, STATS_TEXT_SIZE);
+  text_layer_set_text(statsText, statsBuffer);
+  Layer * windowLayer = window_get_root_layer(statsWindow);
+  GRect bounds = layer_get_bounds(windowLayer);
+  text_layer_set_size(statsText, GSize(bounds.size.w - 2 * STATS_MARGIN, STATS_TEXT_MAX_HEIGHT));
+  GSize textSize = text_layer_get_content_size(statsText);
+  textSize.h += STATS_MARGIN;
+  text_layer_set_size(statsText, GSize(bounds.size.w - 2 * STATS_MARGIN, textSize.h));
+  scroll_layer_set_content_size(statsScroll, GSize(bounds.size.w, textSize.h));
+}
+
+/**
+*Sets up select button handlers. The scroll layer handles up and down.
+*@param context unused
+*/
+static void click_config_provider(void * context){
+  window_single_click_subscribe(BUTTON_ID_SELECT, select_click);
+  window_long_click_subscribe(BUTTON_ID_SELECT, 0, select_long_click, NULL);
+}
+
+/**
+*Writes the statistics to the app log
+*@param recognizer unused
+*@param context unused
+*/
+static void select_click(ClickRecognizerRef recognizer, void * context){
+  stats_log();
+  show_notification("Stats written to log", 1, GColorGreen, (NotifyCallbacks){0});
+}
+
+/**
+*Resets the statistics
+*@param recognizer unused
+*@param context unused
+*/
+static void select_long_click(ClickRecognizerRef recognizer, void * context){
+  stats_reset();
+  update_stats_text();
+}
@@ -0,0 +1,11 @@
+#include <pebble.h>
+#pragma once
+
+/**
+*@File stats_view.h
+*A hidden screen showing messaging statistics.  Select writes
+*the statistics to the app log, long select resets them.
+*/
+
+//Opens the messaging statistics screen
+void open_stats_view();
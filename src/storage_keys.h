@@ -14,5 +14,6 @@ enum{
   PERSIST_KEY_TEXT_COLOR,
   PERSIST_KEY_BG_SELECTION_COLOR,
   PERSIST_KEY_TEXT_SELECTION_COLOR,
-  PERSIST_KEY_ENABLE_PAGING    
+  PERSIST_KEY_ENABLE_PAGING,
+  PERSIST_KEY_ENABLE_LINE_RENDERER
 };
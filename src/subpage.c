@@ -2,6 +2,8 @@
 #include "subpage.h"
 #include "util.h"
 #include "options.h"
+#include "heap_budget.h"
+#include "text_lines.h"
 
 //#define SUBPAGE_DEBUG_ENABLED//comment out to disable page debug logs
 #ifdef SUBPAGE_DEBUG_ENABLED
@@ -12,45 +14,127 @@
 #define SUBPAGE_ERROR(fmt, args...) 
 #endif
 
-#define MEMORY_THRESHOLD 1500
-//if memory drops below this level, unload subpages
+#define MAX_LOADED_SUBPAGES PBL_IF_COLOR_ELSE(64,32)
+//most subpages held at once, the far end is unloaded to make room
 
+#define LIVE_LAYER_MARGIN 1
+//screen heights above and below the view where subpages keep a text
+//layer, subpages farther away keep only their text and cached height
 
+#define MIN_LOADED_SUBPAGES 2
+//subpages kept loaded around the reader, even when over budget
+
+#define PAGING_FIT_ATTEMPTS 6
+//most positions measured when fitting a paged subpage above the text
+
+#define LAYER_Y_LIMIT SCROLL_WINDOW_HEIGHT
+//text layers farther than this outside the scroll window are only
+//there to be measured, and are moved closer by whole pages so their
+//coordinates stay in range
+
+#define SUBPAGE_LAYER_BYTES 100
+//approximate heap used by each subpage's text layer, counted
+//against the subpage budget along with its text
 
 //----------SUBPAGE DATA----------
 //Each subpage contains a portion of the saved page text, subpages are 
-//of similar but not identical length
-typedef struct sub{
+//of similar but not identical length.  Subpages near the view are live,
+//with a text layer in the scroll layer.  Subpages farther away are
+//demoted, releasing their text layer but keeping their text and cached
+//position, so they can be promoted again without asking the phone.
+//When the line renderer is used, subpages never get text layers and
+//are drawn from their line index instead.
+typedef struct{
   int pageIndex;
   char * pageString;
-  TextLayer * pageText;
-  struct sub * nextPage;
+  TextLayer * pageText;//text layer, or NULL if the subpage is demoted
+  LineIndex lines;//wrapped lines, only used by the line renderer
+  int32_t top;//cached y coordinate in the text
+  int height;//cached height of the text layer
+  bool measured;//false if height must be measured again before it's trusted
 }Subpage;
 
-Subpage * firstSubpage = NULL;
+//Text layout settings that cached subpage heights depend on.  Heights
+//are only measured again when one of these changes, or when paged text
+//moves to a different position on the page grid.
+typedef struct{
+  GFont font;
+  int width;
+  bool paging;
+}LayoutKey;
+
+//Loaded subpages are kept in page order in a circular array, starting at
+//firstSlot.  Subpage indexes are always consecutive, so a subpage's position
+//in the array is its index minus the first loaded index.
+static Subpage subpages[MAX_LOADED_SUBPAGES];
+static int firstSlot = 0;//array slot of the first subpage
+static int subpageCount = 0;//number of loaded subpages
+static bool addingAtFront = false;//true while making room for a subpage before the first one
+static bool addingAtEnd = false;//true while making room for a subpage after the last one
 ScrollLayer * parentLayer = NULL;
+//Single layer drawing the lines in view, or NULL if each subpage has its
+//own text layer
+static Layer * lineCanvas = NULL;
+static LayoutKey measuredLayout;//layout settings subpage heights were measured with
+static int32_t windowTop = 0;//text y coordinate at the top of the scroll layer's content
 //----------STATIC FUNCTION DECLARATIONS----------
 //creates a new subpage
-static Subpage * subpage_create(char * subpageText, int subpageIndex);
+static bool subpage_create(Subpage * subpage, char * subpageText, int subpageIndex);
+//creates a subpage's text layer at its cached position
+static bool subpage_create_layer(Subpage * subpage);
+//gives a demoted subpage a text layer again
+static void subpage_promote(int position);
+//releases a subpage's text layer, keeping its text
+static void subpage_demote(Subpage * subpage);
+//draws the lines of every subpage in the parent layer's view
+static void draw_visible_lines(Layer * layer, GContext * ctx);
 //deallocates a given subpage
 static void subpage_destroy(Subpage * subpage);
+//get the subpage at a position, counting from the first subpage
+static Subpage * subpage_at(int position);
 //get the last subpage in the list
 static Subpage * getLastSubpage();
+//find the position of the last subpage starting above a y coordinate
+static int find_subpage_position(int32_t y);
+//convert a text y coordinate to a y coordinate in the scroll layer
+static int window_y(int32_t y);
+//move a subpage to a y coordinate without measuring it
+static void subpage_move(Subpage * subpage, int32_t top);
+//measure a subpage's height at its current position
+static void subpage_measure(Subpage * subpage);
+//move a subpage to a y coordinate and resize it to fit its text
+static void subpage_place(Subpage * subpage, int32_t top);
+//add a subpage's text layer to the parent layer
+static void subpage_attach_layer(Subpage * subpage);
+//check if the layout settings changed since heights were measured
+static bool layout_changed();
+//update every subpage for new layout settings
+static void invalidate_layout();
+//lay out subpages again from the top of the text
+static void subpage_reflow();
+//move a subpage, measuring paged text again if it leaves the page grid
+static void subpage_relocate(Subpage * subpage, int32_t top);
+//lay out the subpages after a position again
+static void subpage_reflow_below(int position);
+//lay out the subpages before a position again
+static void subpage_reflow_above(int position);
 //add a subpage to the front of the list
 static void subpage_push_front(Subpage * subpage);
 //add a subpage to the end of the list
 static void subpage_push_end(Subpage * subpage);
-//remove and return the first subpage from the list
-static Subpage * subpage_pop_front();
-//remove and return the last subpage from the list
-static Subpage * subpage_pop_end();
-//resize a subpage's text layer to fit its content
+//place a paged subpage as low as it fits above a y coordinate
+static void subpage_fit_above(Subpage * subpage, int32_t bottom);
+//resize a text layer to fit its content
 //return: the new text layer height
 static int resize_textLayer_to_content(TextLayer * textlayer);
 //destroy the subpage at the front of the list
 static void subpage_destroy_front();
 //destroy the subpage at the end of the list
 static void subpage_destroy_end();
+//get the heap bytes a subpage's text and layer are charged for
+static size_t subpage_cost(Subpage * subpage);
+//unload subpages far from the reader when the heap budget needs memory
+static size_t evict_subpages(size_t bytes);
 //----------PUBLIC FUNCTIONS----------
 
 //Sets a scroll layer as the new parent layer for all subpages
@@ -61,6 +145,14 @@ void subpage_set_parent(ScrollLayer * parent){
     SUBPAGE_DEBUG("subpage_set_parent:new parent layer set, removing old sublayers");
     subpage_destroy_all();
     parentLayer = parent;
+    budget_register(BUDGET_SUBPAGES, evict_subpages);
+    if(parentLayer != NULL && getLineRendererEnabled()){
+      lineCanvas = layer_create(GRect(0,0,SCREEN_WIDTH,SCROLL_WINDOW_HEIGHT));
+      if(lineCanvas != NULL){
+        layer_set_update_proc(lineCanvas, draw_visible_lines);
+        scroll_layer_add_child(parentLayer, lineCanvas);
+      }
+    }
   }
 }
 
@@ -72,14 +164,63 @@ void subpage_set_parent(ScrollLayer * parent){
 void subpage_init(char * pageText, int pageIndex){
   if(parentLayer == NULL){
     SUBPAGE_ERROR("subpage_init: can't create subpages without first setting a parent layer");
+    free(pageText);
     return;
   }
-  if(pageIndex == first_page_index()-1 || firstSubpage == NULL)
-    subpage_push_front(subpage_create(pageText,pageIndex));
-  else if(pageIndex == last_page_index()+1)
-    subpage_push_end(subpage_create(pageText,pageIndex));
-  else{
+  if(layout_changed()) invalidate_layout();
+  bool atFront = subpageCount == 0 || pageIndex == first_page_index()-1;
+  if(!atFront && pageIndex != last_page_index()+1){
     SUBPAGE_ERROR("subpage_init: received invalid page index %d, expected %d or %d",pageIndex,first_page_index()-1,last_page_index()+1);
+    free(pageText);
+    return;
+  }
+  //make room in the subpage budget, unloading the subpages farthest from
+  //the reader if needed.  A few subpages are always allowed so the page
+  //can still be read when the budget is tight.
+  size_t cost = strlen(pageText) + 1 + SUBPAGE_LAYER_BYTES;
+  addingAtFront = atFront && subpageCount > 0;
+  addingAtEnd = !atFront;
+  //a full subpage list makes room the same way, so the reader's side is kept
+  if(subpageCount == MAX_LOADED_SUBPAGES) evict_subpages(1);
+  bool reserved = subpageCount < MAX_LOADED_SUBPAGES && budget_reserve(BUDGET_SUBPAGES, cost);
+  addingAtFront = addingAtEnd = false;
+  if(!reserved){
+    if(subpageCount >= MIN_LOADED_SUBPAGES){
+      SUBPAGE_DEBUG("subpage_init: no room for subpage %d",pageIndex);
+      free(pageText);
+      return;
+    }
+    budget_charge(BUDGET_SUBPAGES, cost);
+  }
+  Subpage newSub;
+  if(!subpage_create(&newSub,pageText,pageIndex)){
+    budget_release(BUDGET_SUBPAGES, cost);
+    return;
+  }
+  //replace the estimate with what the subpage actually holds
+  budget_release(BUDGET_SUBPAGES, cost);
+  budget_charge(BUDGET_SUBPAGES, subpage_cost(&newSub));
+  if(atFront) subpage_push_front(&newSub);
+  else subpage_push_end(&newSub);
+  subpage_update_residency();
+  if(lineCanvas != NULL) layer_mark_dirty(lineCanvas);
+}
+
+/**
+*Promotes subpages near the parent layer's view to live text layers,
+*and demotes the rest to text only
+*/
+void subpage_update_residency(){
+  if(parentLayer == NULL || subpageCount == 0 || lineCanvas != NULL) return;
+  int32_t viewTop = windowTop - scroll_layer_get_content_offset(parentLayer).y;
+  int viewHeight = layer_get_frame(scroll_layer_get_layer(parentLayer)).size.h;
+  int32_t liveTop = viewTop - viewHeight * LIVE_LAYER_MARGIN;
+  int32_t liveBottom = viewTop + viewHeight * (LIVE_LAYER_MARGIN + 1);
+  for(int i = 0; i < subpageCount; i++){
+    Subpage * subpage = subpage_at(i);
+    bool nearView = subpage->top < liveBottom && subpage->top + subpage->height > liveTop;
+    if(nearView && subpage->pageText == NULL) subpage_promote(i);
+    else if(!nearView && subpage->pageText != NULL) subpage_demote(subpage);
   }
 }
 
@@ -90,135 +231,124 @@ void subpage_init(char * pageText, int pageIndex){
 Bookmark bookmark_from_parent_offset(){
   //find the right subpage
   GPoint offset = scroll_layer_get_content_offset(parentLayer);
-  return bookmark_from_offset(offset.y);
+  return bookmark_from_position(windowTop - offset.y);
 }
 
 /**
-*Gets a bookmark marking the given vertical scroll offset
+*Gets a bookmark marking a y coordinate in the text
 */
-Bookmark bookmark_from_offset(int offset){
-  SUBPAGE_DEBUG("bookmark_from_offset:finding bookmark for offset=%d",offset);
-  if(firstSubpage == NULL) return (Bookmark){-1,-1};
-  Subpage * index = firstSubpage;
-  int subpage = index->pageIndex;
-  GRect lastFrame = GRect(0,0,0,0);
-  while(index != NULL){
-    GRect subFrame = layer_get_frame(text_layer_get_layer(index->pageText));
-    if(-offset <= subFrame.origin.y)break;
-    lastFrame = subFrame;
-    subpage = index->pageIndex;
-    index = index->nextPage;
-  }
-  if(lastFrame.origin.y <= -offset){
-    //last subpage was the current one, find & return percent
-    int pageOffset = -offset - lastFrame.origin.y;
-    //pageOffset/pageHeight = percentOffset/100
-    //pageOffset*100/pageHeight = percentOffset;
-    int percentOffset = pageOffset * 100 / lastFrame.size.h;
-    if(percentOffset > 100)percentOffset = 100;
-    SUBPAGE_DEBUG("bookmark_from_offset:offset:%d = pg%d,%d%%" ,offset,subpage,pageOffset * 100 / lastFrame.size.h);
-    return (Bookmark){subpage, pageOffset * 100 / lastFrame.size.h};
-  }
-  else return (Bookmark){firstSubpage->pageIndex,0};
+Bookmark bookmark_from_position(int32_t y){
+  SUBPAGE_DEBUG("bookmark_from_position:finding bookmark for y=%d",(int) y);
+  if(subpageCount == 0) return (Bookmark){-1,-1};
+  int position = find_subpage_position(y);
+  if(position < 0) return (Bookmark){first_page_index(),0};
+  Subpage * subpage = subpage_at(position);
+  if(subpage->height <= 0) return (Bookmark){subpage->pageIndex,0};
+  //pageOffset/pageHeight = percentOffset/100
+  //pageOffset*100/pageHeight = percentOffset;
+  int32_t pageOffset = y - subpage->top;
+  int percentOffset = pageOffset * 100 / subpage->height;
+  if(percentOffset > 100)percentOffset = 100;
+  SUBPAGE_DEBUG("bookmark_from_position:y:%d = pg%d,%d%%" ,(int) y,subpage->pageIndex,percentOffset);
+  return (Bookmark){subpage->pageIndex, percentOffset};
 }
 
 /**
-*Given a bookmark, return the corresponding offset
+*Given a bookmark, return the corresponding y coordinate in the text
 */
-GPoint offset_from_bookmark(Bookmark bookmark){
+int32_t position_from_bookmark(Bookmark bookmark){
   //find the marked subpage
-  Subpage * index = firstSubpage;
-  while(index != NULL){
-    if(index->pageIndex == bookmark.subpage)break;
-    index = index->nextPage;
+  int position = bookmark.subpage - first_page_index();
+  if(subpageCount == 0 || position < 0 || position >= subpageCount){
+    SUBPAGE_ERROR("position_from_bookmark:failed to find subpage %d",bookmark.subpage);
+    return get_text_top();
   }
-  if(index == NULL){
-    SUBPAGE_ERROR("offset_from_bookmark:failed to find subpage %d",bookmark.subpage);
-    return GPoint(-1,-1);
-  }
-  //get subpage frame
-  GRect frame = layer_get_frame(text_layer_get_layer(index->pageText));
+  Subpage * subpage = subpage_at(position);
   int percentHeight = 0;
   if(bookmark.offsetPercent != 0)
-    percentHeight = frame.size.h * bookmark.offsetPercent / 100;
-  return GPoint(0,-(frame.origin.y + percentHeight));
+    percentHeight = subpage->height * bookmark.offsetPercent / 100;
+  return subpage->top + percentHeight;
 }
 
 /**
-*Vertically moves the start of the text to a given offset
-*offset: amount to move subpages
+*Gets the text y coordinate shown at the top of the scroll layer's content
 */
-void subpage_translate_all(int offset){
-  if(firstSubpage == NULL){
-    SUBPAGE_ERROR("subpage_translate_all:no subpages found!");
-    return;
+int32_t subpage_window_top(){
+  return windowTop;
+}
+
+/**
+*Moves the scroll layer's window over the text.  Subpage positions don't
+*change, so only live text layers are moved.
+*shift: distance to move the window down the text, negative to move up
+*/
+void subpage_shift_window(int32_t shift){
+  SUBPAGE_DEBUG("subpage_shift_window:moving window by %d",(int) shift);
+  windowTop += shift;
+  if(subpageCount == 0) return;
+  //paged text only keeps its layout when moved by whole pages
+  if(getPagingEnabled()){
+    int pageHeight = layer_get_frame(scroll_layer_get_layer(parentLayer)).size.h;
+    if(pageHeight <= 0 || shift % pageHeight != 0){
+      for(int i = 0; i < subpageCount; i++) subpage_at(i)->measured = false;
+      subpage_reflow();
+      return;
+    }
   }
-  SUBPAGE_DEBUG("subpage_translate_all:moving by %d",offset);
-  //move first subpage by offset,each other subpage to align with the previous one
-  Subpage * pageIndex = firstSubpage;
-  int nextLayerOrigin = get_text_top() + offset;
-  while(pageIndex != NULL){
-    Layer * pageLayer = text_layer_get_layer(pageIndex->pageText);
-    GRect pageFrame = layer_get_frame(pageLayer);
-    pageFrame.origin.y = nextLayerOrigin;
-    layer_set_frame(pageLayer,pageFrame);
-    nextLayerOrigin = pageFrame.origin.y + resize_textLayer_to_content(pageIndex->pageText);
-    pageIndex = pageIndex->nextPage;
+  for(int i = 0; i < subpageCount; i++){
+    Subpage * subpage = subpage_at(i);
+    if(subpage->pageText != NULL) subpage_move(subpage, subpage->top);
   }
+  if(lineCanvas != NULL) layer_mark_dirty(lineCanvas);
 }
 
 /**
 *destroy all subpages
 */
 void subpage_destroy_all(){
-  //PAGE_DEBUG("subpage_destroy_all: begin.");
-  Subpage * removedPage = subpage_pop_front();
-  int pagesRemoved = 0;
-  while(removedPage != NULL){
-    subpage_destroy(removedPage);
-    removedPage = subpage_pop_front();
-    pagesRemoved++;
+  int pagesRemoved = subpageCount;
+  for(int i = 0; i < subpageCount; i++) subpage_destroy(subpage_at(i));
+  subpageCount = 0;
+  firstSlot = 0;
+  if(lineCanvas != NULL){
+    layer_destroy(lineCanvas);
+    lineCanvas = NULL;
   }
   parentLayer = NULL;
+  windowTop = 0;
   SUBPAGE_DEBUG("subpage_destroy_all:destroyed %d pages", pagesRemoved);
 }
 
 /**
 *gets the y position of the top of all loaded text
 */
-int get_text_top(){
-  //PAGE_DEBUG("getTextTop: finding highest text coord");
-  if(firstSubpage == NULL)return 0;
-  int textTop = layer_get_frame(text_layer_get_layer(firstSubpage->pageText)).origin.y;
-  //PAGE_DEBUG("getTextTop: top is at %d", textTop);
-  return textTop;
+int32_t get_text_top(){
+  if(subpageCount == 0)return 0;
+  return subpage_at(0)->top;
 }
 
 /**
 *gets the y position of the bottom of all loaded text
 */
-int get_text_bottom(){
-  //PAGE_DEBUG("getTextBottom: finding lowest text coord.");
-  if(firstSubpage == NULL)return 0;
-  GRect lastPageFrame = layer_get_frame(text_layer_get_layer(getLastSubpage()->pageText));
-  int textBottom = lastPageFrame.origin.y + lastPageFrame.size.h;
-  //PAGE_DEBUG("getTextBottom: bottom is at %d", textBottom);
-  return textBottom;
+int32_t get_text_bottom(){
+  if(subpageCount == 0)return 0;
+  Subpage * lastPage = getLastSubpage();
+  return lastPage->top + lastPage->height;
 }
 
 /**
 *returns the index of the first subpage
 */
 int first_page_index(){
-  if(firstSubpage == NULL)return 0;
-  else return firstSubpage->pageIndex;
+  if(subpageCount == 0)return 0;
+  else return subpage_at(0)->pageIndex;
 }
 
 /**
 *returns the index of the last subpage
 */
 int last_page_index(){
-  if(firstSubpage == NULL)return 0;
+  if(subpageCount == 0)return 0;
   else return getLastSubpage()->pageIndex;
 }
 
@@ -227,104 +357,420 @@ int last_page_index(){
 
 /**
 *creates a new subpage
+*subpage: the subpage to initialize
+*subpageText: subpage text allocated with malloc, freed if creation fails
+*subpageIndex: subpage index
+*return: true if the subpage was created
+*/
+static bool subpage_create(Subpage * subpage, char * subpageText, int subpageIndex){
+  //the subpage keeps the text buffer it was given instead of copying it
+  subpage->pageString = subpageText;
+  subpage->pageIndex = subpageIndex;
+  subpage->top = windowTop;
+  subpage->lines = (LineIndex){0};
+  subpage->pageText = NULL;
+  if(lineCanvas != NULL){
+    GFont font = getPageFont();
+    if(!line_index_build(&subpage->lines, subpageText, font, SCREEN_WIDTH)){
+      SUBPAGE_ERROR("subpage_create:not enough memory to index subpage %d",subpageIndex);
+      free(subpageText);
+      subpage->pageString = NULL;
+      return false;
+    }
+    subpage->height = subpage->lines.count * text_line_height(font);
+    subpage->measured = true;
+    return true;
+  }
+  subpage->height = 30000;
+  if(!subpage_create_layer(subpage)){
+    SUBPAGE_ERROR("subpage_create:not enough memory for subpage %d",subpageIndex);
+    free(subpageText);
+    subpage->pageString = NULL;
+    return false;
+  }
+  subpage->height = 0;
+  subpage->measured = false;
+  return true;
+}
+
+/**
+*creates a subpage's text layer at its cached position
+*subpage: a subpage without a text layer
+*return: true if the layer was created
 */
-static Subpage * subpage_create(char * subpageText, int subpageIndex){
-  Subpage * newSub = malloc(sizeof(Subpage));//allocate page
-  //allocate textLayer and string
-  newSub->pageText = text_layer_create(GRect(0,0,SCREEN_WIDTH,30000));
-  newSub->pageString = malloc_set_text(newSub->pageText,NULL, subpageText, strlen(subpageText));
+static bool subpage_create_layer(Subpage * subpage){
+  subpage->pageText = text_layer_create(GRect(0,window_y(subpage->top),SCREEN_WIDTH,subpage->height));
+  if(subpage->pageText == NULL) return false;
+  text_layer_set_text(subpage->pageText, subpage->pageString);
   //set text layer properties
-  text_layer_set_font(newSub->pageText,getPageFont());
-  text_layer_set_background_color(newSub->pageText, getBGColor());
-  text_layer_set_text_color(newSub->pageText, getTextColor());
-  //initialize index and nextpage to default values
-  newSub->nextPage = NULL;
-  newSub->pageIndex = subpageIndex;
-  return newSub;
+  text_layer_set_font(subpage->pageText,getPageFont());
+  text_layer_set_background_color(subpage->pageText, getBGColor());
+  text_layer_set_text_color(subpage->pageText, getTextColor());
+  return true;
+}
+
+/**
+*gives a demoted subpage a text layer again, placed at its cached
+*position.  If the subpage's height is out of date, it's measured again
+*and the subpages around it are laid out again to make room.  The
+*subpage being read never moves: a subpage above it grows or shrinks
+*upward, moving the subpages before it, and any other subpage moves
+*the subpages after it.
+*position: the subpage's position, counting from the first subpage
+*/
+static void subpage_promote(int position){
+  Subpage * subpage = subpage_at(position);
+  if(!subpage_create_layer(subpage)){
+    SUBPAGE_ERROR("subpage_promote:not enough memory to show subpage %d",subpage->pageIndex);
+    return;
+  }
+  budget_charge(BUDGET_SUBPAGES, SUBPAGE_LAYER_BYTES);
+  subpage_attach_layer(subpage);
+  if(subpage->measured) return;
+  int oldHeight = subpage->height;
+  int32_t oldBottom = subpage->top + subpage->height;
+  subpage_measure(subpage);
+  if(subpage->height == oldHeight) return;
+  SUBPAGE_DEBUG("subpage_promote:subpage %d height changed by %d",
+                subpage->pageIndex,subpage->height - oldHeight);
+  int32_t viewTop = windowTop - scroll_layer_get_content_offset(parentLayer).y;
+  if(position < find_subpage_position(viewTop + 1)){
+    if(getPagingEnabled()) subpage_fit_above(subpage, oldBottom);
+    else subpage_move(subpage, oldBottom - subpage->height);
+    subpage_reflow_above(position);
+  }
+  else subpage_reflow_below(position);
+}
+
+/**
+*releases a subpage's text layer, keeping its text and cached position
+*subpage: a live subpage
+*/
+static void subpage_demote(Subpage * subpage){
+  text_layer_destroy(subpage->pageText);
+  subpage->pageText = NULL;
+  budget_release(BUDGET_SUBPAGES, SUBPAGE_LAYER_BYTES);
+}
+
+/**
+*draws the lines of every subpage in the parent layer's view, so redraw
+*cost depends on the screen size rather than the loaded text
+*layer: the line renderer layer
+*ctx: the graphics context
+*/
+static void draw_visible_lines(Layer * layer, GContext * ctx){
+  if(parentLayer == NULL || subpageCount == 0) return;
+  //view bounds in canvas coordinates
+  int viewTop = -scroll_layer_get_content_offset(parentLayer).y;
+  int viewBottom = viewTop + layer_get_frame(scroll_layer_get_layer(parentLayer)).size.h;
+  graphics_context_set_fill_color(ctx, getBGColor());
+  graphics_fill_rect(ctx, GRect(0, viewTop, SCREEN_WIDTH, viewBottom - viewTop), 0, GCornerNone);
+  graphics_context_set_text_color(ctx, getTextColor());
+  GFont font = getPageFont();
+  int position = find_subpage_position(windowTop + viewTop + 1);
+  if(position < 0) position = 0;
+  for(; position < subpageCount; position++){
+    Subpage * subpage = subpage_at(position);
+    if(subpage->top - windowTop >= viewBottom) break;
+    line_index_draw(ctx, &subpage->lines, subpage->pageString, font,
+                    GPoint(0, subpage->top - windowTop), SCREEN_WIDTH, viewTop, viewBottom);
+  }
 }
 
 /**
 *deallocates a given subpage
 */
 static void subpage_destroy(Subpage * subpage){
-  //PAGE_DEBUG("subpage_destroy: subpage destruction begin.");
-  if(subpage != NULL){
-    if(subpage->pageString != NULL)
-      free(subpage->pageString);
-    if(subpage->pageText != NULL)
-      text_layer_destroy(subpage->pageText);
-    free(subpage);
+  if(subpage->pageString != NULL){
+    budget_release(BUDGET_SUBPAGES, subpage_cost(subpage));
+    free(subpage->pageString);
+    subpage->pageString = NULL;
   }
+  if(subpage->pageText != NULL){
+    text_layer_destroy(subpage->pageText);
+    subpage->pageText = NULL;
+  }
+  line_index_destroy(&subpage->lines);
+}
+
+/**
+*get the subpage at a position, counting from the first subpage
+*/
+static Subpage * subpage_at(int position){
+  return &subpages[(firstSlot + position) % MAX_LOADED_SUBPAGES];
 }
 
 /**
 *get the last subpage in the list
 */
 static Subpage * getLastSubpage(){
-  //PAGE_DEBUG("getLastSubpage: finding last.");
-  Subpage * index = firstSubpage;
-  while(index != NULL && index->nextPage != NULL){
-    index = index->nextPage;
+  return subpage_at(subpageCount - 1);
+}
+
+/**
+*find the position of the last subpage starting above a y coordinate
+*y: a y coordinate in the text
+*return: the subpage position, or -1 if no subpage starts above y
+*/
+static int find_subpage_position(int32_t y){
+  int low = 0;
+  int high = subpageCount - 1;
+  int found = -1;
+  while(low <= high){
+    int middle = (low + high) / 2;
+    if(subpage_at(middle)->top < y){
+      found = middle;
+      low = middle + 1;
+    }
+    else high = middle - 1;
+  }
+  return found;
+}
+
+/**
+*convert a text y coordinate to a y coordinate in the scroll layer.
+*Coordinates far outside the scroll window are moved by whole pages
+*until they're near it, which keeps them in range without changing
+*how paged text flows.
+*y: a y coordinate in the text
+*return: the matching scroll layer y coordinate
+*/
+static int window_y(int32_t y){
+  int32_t layerY = y - windowTop;
+  if(layerY >= -LAYER_Y_LIMIT && layerY <= SCROLL_WINDOW_HEIGHT + LAYER_Y_LIMIT) return layerY;
+  int pageHeight = layer_get_frame(scroll_layer_get_layer(parentLayer)).size.h;
+  if(pageHeight <= 0) return 0;
+  return layerY % pageHeight;
+}
+
+/**
+*move a subpage's text layer to a y coordinate and update its cached
+*position, keeping its cached height.  Demoted subpages only update
+*their cached position.
+*/
+static void subpage_move(Subpage * subpage, int32_t top){
+  subpage->top = top;
+  if(subpage->pageText == NULL) return;
+  layer_set_frame(text_layer_get_layer(subpage->pageText),
+                  GRect(0, window_y(top), SCREEN_WIDTH, subpage->height));
+}
+
+/**
+*measure a subpage's height at its current position, resizing its
+*text layer to fit.  Line renderer heights come from the line index,
+*and demoted subpages keep their cached height until promoted.
+*/
+static void subpage_measure(Subpage * subpage){
+  if(subpage->pageText == NULL) return;
+  subpage->height = resize_textLayer_to_content(subpage->pageText);
+  subpage->measured = true;
+}
+
+/**
+*move a subpage's text layer to a y coordinate, resize it to
+*fit its text, and update its cached position
+*/
+static void subpage_place(Subpage * subpage, int32_t top){
+  subpage_move(subpage, top);
+  subpage_measure(subpage);
+}
+
+/**
+*add a subpage's text layer to the parent layer, setting up paged
+*text flow once it's in the layer hierarchy
+*/
+static void subpage_attach_layer(Subpage * subpage){
+  if(subpage->pageText == NULL) return;
+  scroll_layer_add_child(parentLayer, text_layer_get_layer(subpage->pageText));
+  if(getPagingEnabled()){
+    text_layer_enable_screen_text_flow_and_paging(subpage->pageText, 3);
+    text_layer_set_text_alignment(subpage->pageText, GTextAlignmentCenter);
+  }
+}
+
+/**
+*check if the page font, width, or paging setting changed since
+*subpage heights were measured
+*return: true if the settings changed, the new settings are saved
+*/
+static bool layout_changed(){
+  LayoutKey layout = {getPageFont(), SCREEN_WIDTH, getPagingEnabled()};
+  if(layout.font == measuredLayout.font && layout.width == measuredLayout.width &&
+     layout.paging == measuredLayout.paging) return false;
+  measuredLayout = layout;
+  return true;
+}
+
+/**
+*update every loaded subpage for new layout settings, then lay them
+*out again from the top of the text
+*/
+static void invalidate_layout(){
+  if(subpageCount == 0) return;
+  SUBPAGE_DEBUG("invalidate_layout:layout settings changed, measuring %d subpages",subpageCount);
+  for(int i = 0; i < subpageCount; i++){
+    Subpage * subpage = subpage_at(i);
+    subpage->measured = false;
+    if(subpage->pageText != NULL){
+      text_layer_set_font(subpage->pageText, measuredLayout.font);
+      text_layer_set_text_alignment(subpage->pageText, GTextAlignmentLeft);
+      if(measuredLayout.paging){
+        text_layer_enable_screen_text_flow_and_paging(subpage->pageText, 3);
+        text_layer_set_text_alignment(subpage->pageText, GTextAlignmentCenter);
+      }
+    }
+    else if(subpage->lines.starts != NULL){
+      size_t oldSize = line_index_size(&subpage->lines);
+      line_index_destroy(&subpage->lines);
+      if(line_index_build(&subpage->lines, subpage->pageString, measuredLayout.font, SCREEN_WIDTH))
+        subpage->height = subpage->lines.count * text_line_height(measuredLayout.font);
+      else subpage->height = 0;
+      budget_release(BUDGET_SUBPAGES, oldSize);
+      budget_charge(BUDGET_SUBPAGES, line_index_size(&subpage->lines));
+      subpage->measured = true;
+    }
+  }
+  subpage_reflow();
+}
+
+/**
+*lay out subpages again from the top of the text, each subpage starting
+*where the previous one ends.  Live subpages with out of date heights
+*are measured, demoted subpages are measured when they're promoted.
+*/
+static void subpage_reflow(){
+  if(subpageCount == 0) return;
+  int32_t nextTop = get_text_top();
+  for(int i = 0; i < subpageCount; i++){
+    Subpage * subpage = subpage_at(i);
+    subpage_move(subpage, nextTop);
+    if(!subpage->measured && subpage->pageText != NULL) subpage_measure(subpage);
+    nextTop = subpage->top + subpage->height;
+  }
+  if(lineCanvas != NULL) layer_mark_dirty(lineCanvas);
+}
+
+/**
+*move a subpage to a y coordinate in the text.  Paged text flows
+*differently unless it's moved by whole pages, so a live paged subpage
+*is measured again, and a demoted one is measured when it's promoted.
+*subpage: a loaded subpage
+*top: the subpage's new y coordinate
+*/
+static void subpage_relocate(Subpage * subpage, int32_t top){
+  int32_t shift = top - subpage->top;
+  subpage_move(subpage, top);
+  if(shift == 0 || !getPagingEnabled()) return;
+  int pageHeight = layer_get_frame(scroll_layer_get_layer(parentLayer)).size.h;
+  if(pageHeight > 0 && shift % pageHeight == 0) return;
+  subpage->measured = false;
+  subpage_measure(subpage);
+}
+
+/**
+*lay out the subpages after a position again, each starting where the
+*previous one ends
+*position: the last subpage that keeps its place
+*/
+static void subpage_reflow_below(int position){
+  for(int i = position + 1; i < subpageCount; i++){
+    Subpage * previous = subpage_at(i - 1);
+    subpage_relocate(subpage_at(i), previous->top + previous->height);
+  }
+}
+
+/**
+*lay out the subpages before a position again, each ending where the
+*next one starts.  Live paged subpages are fit above the next one the
+*same way subpages added at the front are.
+*position: the first subpage that keeps its place
+*/
+static void subpage_reflow_above(int position){
+  for(int i = position - 1; i >= 0; i--){
+    Subpage * subpage = subpage_at(i);
+    int32_t bottom = subpage_at(i + 1)->top;
+    if(getPagingEnabled() && subpage->pageText != NULL) subpage_fit_above(subpage, bottom);
+    else subpage_relocate(subpage, bottom - subpage->height);
   }
-  return index;
 }
 
 /**
 *add the first page to the list
 */
 static void subpage_add_first(Subpage * subpage){
-  firstSubpage = subpage;
-  Layer * textLayer = text_layer_get_layer(subpage->pageText);
-  if(parentLayer != NULL){
-    scroll_layer_add_child(parentLayer, textLayer);
-    resize_textLayer_to_content(subpage->pageText);
-    SUBPAGE_DEBUG("subpage_add_first:Adding page to index 0, height:%d",get_text_bottom());
-  }
+  firstSlot = 0;
+  subpages[firstSlot] = *subpage;
+  subpageCount = 1;
+  subpage_attach_layer(&subpages[firstSlot]);
+  subpage_place(&subpages[firstSlot], windowTop);
+  SUBPAGE_DEBUG("subpage_add_first:Adding page to index 0, height:%d",(int) get_text_bottom());
 }
 
 /**
 *add a subpage to the front of the list
 */
 static void subpage_push_front(Subpage * subpage){
-  //PAGE_DEBUG("subpage_push_front: begin.");
-  if(firstSubpage == NULL){
+  if(subpageCount == 0){
     subpage_add_first(subpage);
     return;
   }
-  Layer * textLayer = text_layer_get_layer(subpage->pageText);
   //add text layer to scrollLayer
-  scroll_layer_add_child(parentLayer, textLayer);
+  subpage_attach_layer(subpage);
   //position new layer over old first layer
-  resize_textLayer_to_content(subpage->pageText);
-  GRect newPageFrame = layer_get_frame(textLayer);
-  newPageFrame.origin.y = get_text_top() - newPageFrame.size.h;
-  layer_set_frame(textLayer,newPageFrame);
-  if(getPagingEnabled()){
-    //adjust position to correct for changed page height
-    newPageFrame = layer_get_frame(textLayer);
-    //if page is too high, move down until the page is a bit too low
-    while(newPageFrame.origin.y + newPageFrame.size.h <= get_text_top()){
-      newPageFrame.origin.y++;
-      layer_set_frame(textLayer,newPageFrame);
-      resize_textLayer_to_content(subpage->pageText);
-      newPageFrame = layer_get_frame(textLayer);
-    }
-    //page is now definitely too low, move up by one until it isn't
-    while(newPageFrame.origin.y + newPageFrame.size.h > get_text_top()){
-      newPageFrame.origin.y--;
-      layer_set_frame(textLayer,newPageFrame);
-      resize_textLayer_to_content(subpage->pageText);
-      newPageFrame = layer_get_frame(textLayer);
-    }
-  }
+  int32_t textTop = get_text_top();
+  subpage_place(subpage, textTop);
+  if(getPagingEnabled()) subpage_fit_above(subpage, textTop);
+  else subpage_move(subpage, textTop - subpage->height);
   SUBPAGE_DEBUG("subpage_push_front:Adding page to index %d, position %d, height %d",
-                    subpage->pageIndex,newPageFrame.origin.y,newPageFrame.size.h);
+                    subpage->pageIndex,(int) subpage->top,subpage->height);
   //add subpage to list
-  subpage->nextPage = firstSubpage;
-  firstSubpage = subpage;
-  if(heap_bytes_free() < MEMORY_THRESHOLD){
-    SUBPAGE_DEBUG("subpage_push_front:memory limits reached, removing bottom subpage");
-    subpage_destroy_end();
+  firstSlot = (firstSlot + MAX_LOADED_SUBPAGES - 1) % MAX_LOADED_SUBPAGES;
+  subpages[firstSlot] = *subpage;
+  subpageCount++;
+}
+
+/**
+*place a paged subpage as low as it fits above a y coordinate.  Paged
+*text flows differently at different positions, so its height changes as
+*it moves.  Each measured height gives the next position to try, which
+*usually lands on the best position within two or three measurements.
+*If none of the positions tried fit, the last one is moved up by whole
+*pages, leaving a gap instead of overlapping the text below.
+*subpage: a subpage with a measured height
+*bottom: the y coordinate the subpage must end at or above
+*/
+static void subpage_fit_above(Subpage * subpage, int32_t bottom){
+  bool fitFound = false;
+  int32_t bestTop = 0;
+  int bestHeight = 0;
+  int32_t top = bottom - subpage->height;
+  for(int i = 0; i < PAGING_FIT_ATTEMPTS; i++){
+    subpage_place(subpage, top);
+    int32_t nextTop = bottom - subpage->height;
+    if(nextTop >= top && (!fitFound || top > bestTop)){
+      fitFound = true;
+      bestTop = top;
+      bestHeight = subpage->height;
+    }
+    //stop on an exact fit, or when the next position can't beat the best one
+    if(nextTop == top || (fitFound && nextTop <= bestTop)) break;
+    top = nextTop;
+  }
+  if(!fitFound){
+    //paged text keeps its layout when moved by whole pages, so moving up
+    //by enough pages to clear the text below always fits
+    int32_t overlap = subpage->top + subpage->height - bottom;
+    int pageHeight = layer_get_frame(scroll_layer_get_layer(parentLayer)).size.h;
+    SUBPAGE_DEBUG("subpage_fit_above:subpage %d overlaps the text below by %d",
+                  subpage->pageIndex, (int) overlap);
+    if(pageHeight <= 0) pageHeight = overlap;
+    subpage_move(subpage, subpage->top - (overlap + pageHeight - 1) / pageHeight * pageHeight);
+    return;
+  }
+  if(subpage->top != bestTop){
+    //the height was already measured at bestTop, so moving back doesn't need a layout
+    subpage->height = bestHeight;
+    subpage_move(subpage, bestTop);
   }
 }
 
@@ -332,83 +778,92 @@ static void subpage_push_front(Subpage * subpage){
 *add a subpage to the end of the list
 */
 static void subpage_push_end(Subpage * subpage){
-  //PAGE_DEBUG("subpage_push_end: begin.");
-  if(firstSubpage == NULL){
+  if(subpageCount == 0){
     subpage_add_first(subpage);
     return;
   }
-  Subpage * lastPage = getLastSubpage();
-  Layer * textLayer = text_layer_get_layer(subpage->pageText);
   //add text layer to scrollLayer
-  scroll_layer_add_child(parentLayer, textLayer);
-  //move textLayer to after the last new page
-  GRect newPageFrame = layer_get_frame(textLayer);
-  newPageFrame.origin.y = get_text_bottom();
-  layer_set_frame(textLayer,newPageFrame);
-  resize_textLayer_to_content(subpage->pageText);
+  subpage_attach_layer(subpage);
+  //move textLayer to after the last page
+  subpage_place(subpage, get_text_bottom());
   //add subpage to list
-  lastPage->nextPage = subpage;
-  if(heap_bytes_free() < MEMORY_THRESHOLD){
-    SUBPAGE_DEBUG("subpage_push_end:memory limits reached, removing top subpage");
-    subpage_destroy_front();
-  }
+  *subpage_at(subpageCount) = *subpage;
+  subpageCount++;
 }
 
 /**
-*remove and return the first subpage from the list
+*destroy the subpage at the front of the list
 */
-static Subpage * subpage_pop_front(){
-  Subpage * front = firstSubpage;
-  if(front != NULL)firstSubpage = front->nextPage;
-  return front;
+static void subpage_destroy_front(){
+  if(subpageCount == 0) return;
+  subpage_destroy(subpage_at(0));
+  firstSlot = (firstSlot + 1) % MAX_LOADED_SUBPAGES;
+  subpageCount--;
 }
 
 /**
-*remove and return the last subpage from the list
+*destroy the subpage at the end of the list
 */
-static Subpage * subpage_pop_end(){
-  Subpage * index = firstSubpage;
-  while(index != NULL && 
-        index->nextPage != NULL &&
-       index->nextPage->nextPage != NULL){
-    index = index->nextPage;
-  }
-  //if 0 or 1 pages found,
-  if(index == firstSubpage){
-    firstSubpage = NULL;
-    return index;
-  }
-  //if more than 1 page found, index = new end page
-  Subpage * removedPage = index->nextPage;
-  index->nextPage = NULL;
-  return removedPage;
+static void subpage_destroy_end(){
+  if(subpageCount == 0) return;
+  subpage_destroy(getLastSubpage());
+  subpageCount--;
 }
 
+
+
 /**
-*destroy the subpage at the front of the list
+*get the heap bytes a subpage's text and layer are charged for
+*subpage: a loaded subpage
+*return: the subpage's cost against the subpage budget
 */
-static void subpage_destroy_front(){
-  subpage_destroy(subpage_pop_front());
+static size_t subpage_cost(Subpage * subpage){
+  size_t cost = strlen(subpage->pageString) + 1 + line_index_size(&subpage->lines);
+  if(subpage->pageText != NULL) cost += SUBPAGE_LAYER_BYTES;
+  return cost;
 }
 
 /**
-*destroy the subpage at the end of the list
+*unload subpages from whichever end is farthest from the reader, until
+*enough memory is released or only MIN_LOADED_SUBPAGES remain.  While
+*a subpage is being added, the end it's added to is never unloaded, and
+*nothing is unloaded if that end is the far one.
+*bytes: the number of bytes the heap budget needs
+*return: the number of bytes released
 */
-static void subpage_destroy_end(){
-  subpage_destroy(subpage_pop_end());
+static size_t evict_subpages(size_t bytes){
+  size_t released = 0;
+  if(parentLayer == NULL || subpageCount == 0) return 0;
+  int current = bookmark_from_parent_offset().subpage;
+  while(released < bytes && subpageCount > MIN_LOADED_SUBPAGES){
+    int frontDistance = current - first_page_index();
+    int endDistance = last_page_index() - current;
+    bool evictFront;
+    if(addingAtEnd){
+      if(frontDistance < endDistance) break;
+      evictFront = true;
+    }else if(addingAtFront){
+      if(endDistance < frontDistance) break;
+      evictFront = false;
+    }else evictFront = frontDistance > endDistance;
+    if(evictFront){
+      released += subpage_cost(subpage_at(0));
+      subpage_destroy_front();
+    }else{
+      released += subpage_cost(getLastSubpage());
+      subpage_destroy_end();
+    }
+  }
+  SUBPAGE_DEBUG("evict_subpages:released %d of %d bytes",(int) released,(int) bytes);
+  return released;
 }
 
-
-
 /**
-*resize the text layer to fit the page content
+*resize the text layer to fit the page content.  Paged text flow is
+*set up once when the layer is attached, not on every resize.
 *return: the new text layer height
 */
 static int resize_textLayer_to_content(TextLayer * textlayer){
-  if(getPagingEnabled()){
-    text_layer_enable_screen_text_flow_and_paging(textlayer, 3);
-    text_layer_set_text_alignment(textlayer, GTextAlignmentCenter);
-  }
   GSize layerSize = layer_get_frame(text_layer_get_layer(textlayer)).size;
   layerSize.h = 30000;
   text_layer_set_size(textlayer,layerSize);
@@ -3,6 +3,12 @@
 //subpage.h handles a collection of subpages, small ordered
 //text display elements that are added to a scrollLayer
 
+//Subpage positions are 32-bit text coordinates, so a page can be any
+//length.  The scroll layer only holds a window of the text this tall,
+//starting at subpage_window_top().  Moving the window only moves the
+//few live text layers near the view.
+#define SCROLL_WINDOW_HEIGHT 10000
+
 //Bookmark: marks a place in the list of subpages
 typedef struct bookmarkStruct{
   //currently viewed subpage
@@ -19,11 +25,19 @@ void subpage_set_parent(ScrollLayer * parent);
 
 /**
 *Creates and adds a new subpage with the given parameters
-*pageText: subpage display text
+*pageText: subpage display text, allocated with malloc.  The subpage
+*takes ownership of the text.
 *pageIndex: subpage index
 */
 void subpage_init(char * pageText, int pageIndex);
 
+/**
+*Gives subpages near the parent layer's view a text layer, and
+*releases the text layers of subpages farther away.  Call this
+*whenever the scroll offset changes.
+*/
+void subpage_update_residency();
+
 /**
 *Gets a bookmark marking the parent layer's current
 *scroll offset
@@ -31,29 +45,36 @@ void subpage_init(char * pageText, int pageIndex);
 Bookmark bookmark_from_parent_offset();
 
 /**
-*Gets a bookmark marking the given vertical scroll offset
+*Gets a bookmark marking a y coordinate in the text
 */
-Bookmark bookmark_from_offset(int offset);
+Bookmark bookmark_from_position(int32_t y);
 
 /**
-*Given a bookmark, return the corresponding offset
+*Given a bookmark, return the corresponding y coordinate in the text
 */
-GPoint offset_from_bookmark(Bookmark bookmark);
+int32_t position_from_bookmark(Bookmark bookmark);
 
 /**
-*Vertically moves the start of the text to a given offset
-*offset: amount to move subpages
+*Gets the text y coordinate shown at the top of the scroll layer's content
 */
-void subpage_translate_all(int offset);
-  
+int32_t subpage_window_top();
+
+/**
+*Moves the scroll layer's window over the text.  Only live text layers
+*are moved.  Paged text keeps its layout if the window moves by whole
+*pages, otherwise it's measured again.
+*shift: distance to move the window down the text, negative to move up
+*/
+void subpage_shift_window(int32_t shift);
+
 //destroys all subpages
 void subpage_destroy_all();
 
 //return the y coordinate of the top of all subpages
-int get_text_top();
+int32_t get_text_top();
 
 //return the y coordinate of the bottom of all subpages
-int get_text_bottom();
+int32_t get_text_bottom();
 
 //returns the index of the first subpage
 int first_page_index();
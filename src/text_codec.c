@@ -0,0 +1,95 @@
+#include <pebble.h>
+#include "text_codec.h"
+
+//----------LOCAL VALUE DEFINITIONS----------
+//#define CODEC_DEBUG_ENABLED//comment out to disable codec debug logs
+#ifdef CODEC_DEBUG_ENABLED
+#define CODEC_ERROR(fmt, ...) APP_LOG(APP_LOG_LEVEL_ERROR,fmt,##__VA_ARGS__);
+#else
+#define CODEC_ERROR(fmt, args...) 
+#endif
+
+#define NUM_DICTIONARY_WORDS 64
+#define TOKEN_DICTIONARY 0x80 //first dictionary word token
+#define TOKEN_REFERENCE 0xC0 //first back-reference token
+#define TOKEN_ESCAPE 0xFE //escaped literal token
+#define MIN_REFERENCE_LENGTH 3 //length of the shortest back-reference
+#define LONG_DISTANCE_FLAG 0x80 //marks a two byte back-reference distance
+
+//----------LOCAL VARIABLES----------
+//common English fragments, in the same order as COMPRESSION_WORDS in app.js
+static const char * dictionaryWords[NUM_DICTIONARY_WORDS] = {
+  " the"," and"," of"," to"," in"," a"," is"," that",
+  " for"," it"," was"," on"," with"," as"," be"," at",
+  " by"," this"," have"," from"," or"," are"," not"," but",
+  " an"," they"," which"," you"," we"," his"," her"," their",
+  " has"," been"," one"," all"," will"," more"," can"," would",
+  " there"," about"," what"," when"," so"," if"," were"," said",
+  "ing ","tion","ed ","er ","ly ","ent",". ",", ",
+  " The","ment","ould","ight","ough"," new"," also"," people"
+};
+
+//----------PUBLIC FUNCTIONS----------
+/**
+*Decompresses text into a new buffer.  Back-references are copied from
+*text already written to the buffer, so no other memory is needed.
+*@param data the compressed text
+*@param size number of bytes in data
+*@return the decompressed, null-terminated text, allocated with malloc,
+*or NULL if the text is invalid or memory ran out
+*/
+char * text_decompress(const uint8_t * data, uint16_t size){
+  if(size < 2) return NULL;
+  uint16_t textSize = data[0] | (data[1] << 8);
+  char * text = malloc(textSize + 1);
+  if(text == NULL){
+    CODEC_ERROR("text_decompress:not enough memory for %d bytes",textSize);
+    return NULL;
+  }
+  uint16_t in = 2;
+  uint16_t out = 0;
+  //every token must decode completely within the declared size
+  bool valid = true;
+  while(valid && in < size){
+    uint8_t token = data[in++];
+    if(token < TOKEN_DICTIONARY){
+      valid = out < textSize;
+      if(valid) text[out++] = token;
+    }
+    else if(token < TOKEN_REFERENCE){
+      const char * word = dictionaryWords[token - TOKEN_DICTIONARY];
+      uint16_t wordLength = strlen(word);
+      valid = textSize - out >= wordLength;
+      if(valid){
+        memcpy(text + out, word, wordLength);
+        out += wordLength;
+      }
+    }
+    else if(token == TOKEN_ESCAPE){
+      valid = in < size && out < textSize;
+      if(valid) text[out++] = data[in++];
+    }
+    else if(token < TOKEN_ESCAPE){
+      uint16_t length = token - TOKEN_REFERENCE + MIN_REFERENCE_LENGTH;
+      uint16_t distance = 0;
+      valid = in < size;
+      if(valid) distance = data[in++];
+      if(valid && (distance & LONG_DISTANCE_FLAG)){
+        valid = in < size;
+        if(valid) distance = ((distance & ~LONG_DISTANCE_FLAG) << 8) | data[in++];
+      }
+      valid = valid && distance > 0 && distance <= out && textSize - out >= length;
+      //copy one byte at a time, since the source may overlap the destination
+      for(uint16_t i = 0; valid && i < length; i++, out++) text[out] = text[out - distance];
+    }
+    else valid = false;
+  }
+  //the input must be used up exactly, and fill the declared size
+  if(!valid || in != size || out != textSize){
+    CODEC_ERROR("text_decompress:invalid data at byte %d, decoded %d of %d",in,out,textSize);
+    free(text);
+    return NULL;
+  }
+  text[out] = '\0';
+  return text;
+}
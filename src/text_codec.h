@@ -0,0 +1,23 @@
+#pragma once
+#include <pebble.h>
+/**
+*@File text_codec.h
+*Decompresses page text sent by the phone.  Compressed text starts
+*with its uint16 little-endian decoded size, followed by tokens:
+*  0x00-0x7F: a literal ASCII byte
+*  0x80-0xBF: one of 64 static dictionary words
+*  0xC0-0xFD: a back-reference of (token - 0xC0 + 3) bytes, followed by
+*             a distance byte, or two bytes if the first has bit 7 set
+*  0xFE:      an escaped literal, the next byte is copied as-is
+*The dictionary must match COMPRESSION_WORDS in app.js.
+*/
+
+/**
+*Decompresses text into a new buffer.  Back-references are copied from
+*text already written to the buffer, so no other memory is needed.
+*@param data the compressed text
+*@param size number of bytes in data
+*@return the decompressed, null-terminated text, allocated with malloc,
+*or NULL if the text is invalid or memory ran out
+*/
+char * text_decompress(const uint8_t * data, uint16_t size);
@@ -0,0 +1,194 @@
+#include <pebble.h>
+#include "text_lines.h"
+
+//----------LOCAL VALUE DEFINITIONS----------
+//#define TEXT_LINES_DEBUG_ENABLED//comment out to disable line index debug logs
+#ifdef TEXT_LINES_DEBUG_ENABLED
+#define TEXT_LINES_DEBUG(fmt, ...) APP_LOG(APP_LOG_LEVEL_DEBUG,fmt,##__VA_ARGS__);
+#else
+#define TEXT_LINES_DEBUG(fmt, args...)
+#endif
+
+#define MEASURE_BOX_HEIGHT 1000 //height of the box used to measure text, enough for several lines
+#define AVERAGE_LINE_LENGTH 20 //guess used to size a new line index
+
+//----------LOCAL VARIABLES----------
+static GFont measuredFont = NULL;//font of the cached line measurements
+static int lineHeight = 0;//distance between line tops in measuredFont
+static int singleLineHeight = 0;//content height of one line in measuredFont
+
+//----------STATIC FUNCTION DECLARATIONS----------
+static void measure_font(GFont font);
+  //Caches the line measurements of a font
+static bool text_fits_line(char * text, uint16_t start, uint16_t end, GFont font, int width);
+  //Checks if part of the text fits on a single line
+static uint16_t find_line_end(char * text, uint16_t start, uint16_t length, GFont font, int width);
+  //Finds the end of the line starting at an offset
+
+//----------PUBLIC FUNCTIONS----------
+/**
+*Gets the distance between the tops of two lines of text
+*@param font the text font
+*@return the line height in pixels
+*/
+int text_line_height(GFont font){
+  measure_font(font);
+  return lineHeight;
+}
+
+/**
+*Finds where text wraps when drawn at a given width
+*@param lines the index to fill
+*@param text the text to wrap.  It's modified while measuring, but
+*restored before returning.
+*@param font the text font
+*@param width the width lines must fit in
+*@return true if the index was built, false if memory ran out
+*/
+bool line_index_build(LineIndex * lines, char * text, GFont font, int width){
+  measure_font(font);
+  uint16_t length = strlen(text);
+  uint16_t capacity = length / AVERAGE_LINE_LENGTH + 2;
+  lines->starts = malloc(capacity * sizeof(uint16_t));
+  lines->count = 0;
+  if(lines->starts == NULL) return false;
+  uint16_t position = 0;
+  while(position < length){
+    //keep a slot free for the end offset
+    if(lines->count + 2 > capacity){
+      capacity *= 2;
+      uint16_t * starts = realloc(lines->starts, capacity * sizeof(uint16_t));
+      if(starts == NULL){
+        line_index_destroy(lines);
+        return false;
+      }
+      lines->starts = starts;
+    }
+    lines->starts[lines->count++] = position;
+    position = find_line_end(text, position, length, font, width);
+    //the space or newline where the line broke isn't part of the next line
+    while(position < length && text[position] == ' ') position++;
+    if(position < length && text[position] == '\n') position++;
+  }
+  lines->starts[lines->count] = length;
+  TEXT_LINES_DEBUG("line_index_build:%d bytes in %d lines",length,lines->count);
+  return true;
+}
+
+/**
+*Frees a line index
+*@param lines an index filled by line_index_build
+*/
+void line_index_destroy(LineIndex * lines){
+  if(lines->starts != NULL) free(lines->starts);
+  lines->starts = NULL;
+  lines->count = 0;
+}
+
+/**
+*Gets the number of bytes a line index holds on the heap
+*@param lines a line index
+*@return the size of the line offset array
+*/
+size_t line_index_size(const LineIndex * lines){
+  if(lines->starts == NULL) return 0;
+  return (lines->count + 1) * sizeof(uint16_t);
+}
+
+/**
+*Draws the lines of indexed text that overlap a vertical range
+*@param ctx the graphics context
+*@param lines the text's line index
+*@param text the indexed text.  It's modified while drawing, but
+*restored before returning.
+*@param font the text font
+*@param origin the top left corner of the first line
+*@param width the line width
+*@param clipTop the top of the range to draw
+*@param clipBottom the bottom of the range to draw
+*/
+void line_index_draw(GContext * ctx, const LineIndex * lines, char * text, GFont font,
+                     GPoint origin, int width, int clipTop, int clipBottom){
+  measure_font(font);
+  if(lines->starts == NULL || lineHeight <= 0) return;
+  int line = (clipTop - origin.y) / lineHeight;
+  if(line < 0) line = 0;
+  for(; line < lines->count; line++){
+    int lineTop = origin.y + line * lineHeight;
+    if(lineTop >= clipBottom) break;
+    uint16_t start = lines->starts[line];
+    uint16_t end = lines->starts[line + 1];
+    while(end > start && (text[end - 1] == ' ' || text[end - 1] == '\n')) end--;
+    if(end == start) continue;
+    char endChar = text[end];
+    text[end] = '\0';
+    graphics_draw_text(ctx, text + start, font, GRect(origin.x, lineTop, width, lineHeight * 2),
+                       GTextOverflowModeWordWrap, GTextAlignmentLeft, NULL);
+    text[end] = endChar;
+  }
+}
+
+//----------STATIC FUNCTIONS----------
+/**
+*Caches the line measurements of a font
+*@param font the text font
+*/
+static void measure_font(GFont font){
+  if(font == measuredFont && lineHeight > 0) return;
+  GRect box = GRect(0, 0, 1000, MEASURE_BOX_HEIGHT);
+  singleLineHeight = graphics_text_layout_get_content_size("A", font, box,
+                       GTextOverflowModeWordWrap, GTextAlignmentLeft).h;
+  lineHeight = graphics_text_layout_get_content_size("A\nA", font, box,
+                 GTextOverflowModeWordWrap, GTextAlignmentLeft).h - singleLineHeight;
+  measuredFont = font;
+}
+
+/**
+*Checks if part of the text fits on a single line
+*@param text the text
+*@param start offset of the first character to measure
+*@param end offset after the last character to measure
+*@param font the text font
+*@param width the line width
+*@return true if the text is drawn without wrapping
+*/
+static bool text_fits_line(char * text, uint16_t start, uint16_t end, GFont font, int width){
+  char endChar = text[end];
+  text[end] = '\0';
+  GSize size = graphics_text_layout_get_content_size(text + start, font,
+                 GRect(0, 0, width, MEASURE_BOX_HEIGHT), GTextOverflowModeWordWrap, GTextAlignmentLeft);
+  text[end] = endChar;
+  return size.h <= singleLineHeight;
+}
+
+/**
+*Finds the end of the line starting at an offset, adding one word at a
+*time until the line is full.  A word too long for a line is split
+*between characters.
+*@param text the text
+*@param start offset of the line's first character
+*@param length the text length
+*@param font the text font
+*@param width the line width
+*@return the offset after the line's last character
+*/
+static uint16_t find_line_end(char * text, uint16_t start, uint16_t length, GFont font, int width){
+  uint16_t end = start;
+  uint16_t next = start;
+  while(next < length && text[next] != '\n'){
+    while(next < length && text[next] == ' ') next++;
+    while(next < length && text[next] != ' ' && text[next] != '\n') next++;
+    if(!text_fits_line(text, start, next, font, width)) break;
+    end = next;
+  }
+  if(end > start || next == start) return end;
+  //the first word doesn't fit, keep as many characters as will
+  end = next;
+  while(end > start + 1){
+    end--;
+    //don't split UTF-8 characters
+    while(end > start + 1 && (text[end] & 0xC0) == 0x80) end--;
+    if(text_fits_line(text, start, end, font, width)) break;
+  }
+  return end;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <pebble.h>
+/**
+*@File text_lines.h
+*Splits text into word-wrapped lines once, so it can be drawn a line at
+*a time.  Drawing only the lines in view keeps redraw cost proportional
+*to what is on screen instead of to the length of the text.
+*/
+
+//Start offsets of each wrapped line in a string
+typedef struct{
+  uint16_t * starts;//offset of the first character of each line
+  uint16_t count;//number of lines
+}LineIndex;
+
+/**
+*Gets the distance between the tops of two lines of text
+*@param font the text font
+*@return the line height in pixels
+*/
+int text_line_height(GFont font);
+
+/**
+*Finds where text wraps when drawn at a given width
+*@param lines the index to fill
+*@param text the text to wrap.  It's modified while measuring, but
+*restored before returning.
+*@param font the text font
+*@param width the width lines must fit in
+*@return true if the index was built, false if memory ran out
+*/
+bool line_index_build(LineIndex * lines, char * text, GFont font, int width);
+
+/**
+*Frees a line index
+*@param lines an index filled by line_index_build
+*/
+void line_index_destroy(LineIndex * lines);
+
+/**
+*Gets the number of bytes a line index holds on the heap
+*@param lines a line index
+*@return the size of the line offset array
+*/
+size_t line_index_size(const LineIndex * lines);
+
+/**
+*Draws the lines of indexed text that overlap a vertical range
+*@param ctx the graphics context
+*@param lines the text's line index
+*@param text the indexed text.  It's modified while drawing, but
+*restored before returning.
+*@param font the text font
+*@param origin the top left corner of the first line
+*@param width the line width
+*@param clipTop the top of the range to draw
+*@param clipBottom the bottom of the range to draw
+*/
+void line_index_draw(GContext * ctx, const LineIndex * lines, char * text, GFont font,
+                     GPoint origin, int width, int clipTop, int clipBottom);
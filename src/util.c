@@ -26,6 +26,17 @@ int getUptime(){
   return (int)time(NULL) - (int) lastLaunch;
 }
 
+/**
+*Gets a millisecond timestamp for measuring short intervals
+*@return the current time in milliseconds, wrapping on overflow
+*/
+uint32_t getTimeMs(){
+  time_t seconds;
+  uint16_t milliseconds;
+  time_ms(&seconds, &milliseconds);
+  return (uint32_t) seconds * 1000 + milliseconds;
+}
+
 /**
 *Gets the total uptime since installation
 *@return  total uptime in seconds
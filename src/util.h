@@ -20,6 +20,12 @@ void getPebbleBattery(char * buffer);
 */
 int getUptime();
 
+/**
+*Gets a millisecond timestamp for measuring short intervals
+*@return the current time in milliseconds, wrapping on overflow
+*/
+uint32_t getTimeMs();
+
 /**
 *Gets the total uptime since installation
 *@return  total uptime in seconds
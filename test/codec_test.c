@@ -0,0 +1,114 @@
+/*
+*@File codec_test.c
+*Host test for text_decompress.  Valid frames must decode to the exact
+*text, and truncated or corrupt frames must be rejected instead of
+*producing shortened text.
+*/
+
+#include <pebble.h>
+#include "text_codec.h"
+
+//----------LOCAL VALUE DEFINITIONS----------
+#define CHECK(condition) do{\
+    if(!(condition)){\
+      fprintf(stderr,"%s:%d: check failed: %s\n",__FILE__,__LINE__,#condition);\
+      exit(1);\
+    }\
+  }while(0)
+
+//----------TEST HELPERS----------
+/**
+*Checks that a frame decodes to the expected text.
+*@param frame the compressed text
+*@param size number of bytes in frame
+*@param expected the text the frame should decode to
+*/
+static void check_decodes(const uint8_t * frame, uint16_t size, const char * expected){
+  char * text = text_decompress(frame, size);
+  CHECK(text != NULL);
+  CHECK(strcmp(text, expected) == 0);
+  free(text);
+}
+
+/**
+*Checks that a frame is rejected.
+*@param frame the compressed text
+*@param size number of bytes in frame
+*/
+static void check_rejected(const uint8_t * frame, uint16_t size){
+  char * text = text_decompress(frame, size);
+  if(text != NULL) fprintf(stderr,"unexpectedly decoded \"%s\"\n",text);
+  CHECK(text == NULL);
+}
+
+//----------TESTS----------
+int main(){
+  //literals, dictionary words, an escape and a back-reference
+  const uint8_t valid[] = {11, 0, 'A', 0x80, 0xFE, 0xE9, 0xC0, 4, 'x', 'y'};
+  check_decodes(valid, sizeof(valid), "A the\xe9" "thexy");
+
+  //overlapping back-reference repeats its source
+  const uint8_t repeat[] = {6, 0, 'a', 'b', 0xC1, 2};
+  check_decodes(repeat, sizeof(repeat), "ababab");
+
+  //long distance back-reference
+  uint8_t longFrame[2 + 200 + 3];
+  longFrame[0] = 203;
+  longFrame[1] = 0;
+  for(int i = 0; i < 200; i++) longFrame[2 + i] = 'a' + i % 26;
+  longFrame[202] = 0xC0;
+  longFrame[203] = 0x80;
+  longFrame[204] = 200;
+  char longText[204];
+  for(int i = 0; i < 200; i++) longText[i] = 'a' + i % 26;
+  memcpy(longText + 200, "abc", 3);
+  longText[203] = '\0';
+  check_decodes(longFrame, sizeof(longFrame), longText);
+
+  //empty text
+  const uint8_t empty[] = {0, 0};
+  check_decodes(empty, sizeof(empty), "");
+
+  //missing or partial header
+  check_rejected(empty, 0);
+  check_rejected(empty, 1);
+
+  //back-reference cut off before its distance byte, after the text is complete
+  const uint8_t truncatedReference[] = {3, 0, 'a', 'b', 'c', 0xC0};
+  check_rejected(truncatedReference, sizeof(truncatedReference));
+
+  //back-reference cut off inside a two byte distance
+  const uint8_t truncatedDistance[] = {6, 0, 'a', 'b', 'c', 0xC0, 0x80};
+  check_rejected(truncatedDistance, sizeof(truncatedDistance));
+
+  //back-reference reaching before the start of the text
+  const uint8_t farReference[] = {5, 0, 'a', 'b', 0xC0, 3};
+  check_rejected(farReference, sizeof(farReference));
+
+  //back-reference with distance zero
+  const uint8_t zeroDistance[] = {4, 0, 'a', 0xC0, 0};
+  check_rejected(zeroDistance, sizeof(zeroDistance));
+
+  //token past the dictionary and reference ranges
+  const uint8_t badToken[] = {1, 0, 'a', 0xFF};
+  check_rejected(badToken, sizeof(badToken));
+
+  //dictionary word running past the declared size
+  const uint8_t longWord[] = {3, 0, 'a', 0x80};
+  check_rejected(longWord, sizeof(longWord));
+
+  //escape with nothing after it
+  const uint8_t truncatedEscape[] = {1, 0, 'a', 0xFE};
+  check_rejected(truncatedEscape, sizeof(truncatedEscape));
+
+  //input ending before the declared size is reached
+  const uint8_t shortText[] = {5, 0, 'a', 'b', 'c'};
+  check_rejected(shortText, sizeof(shortText));
+
+  //bytes left over once the declared size is reached
+  const uint8_t trailing[] = {2, 0, 'a', 'b', 'c'};
+  check_rejected(trailing, sizeof(trailing));
+
+  printf("codec_test: all frames handled\n");
+  return 0;
+}
@@ -0,0 +1,326 @@
+/*
+*@File outbox_test.c
+*Host test for the messaging_core outbox.  Messages are queued with
+*begin_message/end_message and sent through a fake AppMessage outbox,
+*while every malloc, calloc and realloc call is counted, to check that
+*the send path never touches the heap.
+*/
+
+#include <pebble.h>
+#include <stdarg.h>
+#include "messaging_core.h"
+#include "heap_budget.h"
+#include "src/message_keys.auto.h"
+
+//----------LOCAL VALUE DEFINITIONS----------
+#define MAX_SENT 4096 //Most sent messages recorded by the fake outbox
+#define ROUNDS 500 //Number of queue and acknowledge rounds
+#define RESEND_DELAY_LIMIT 60000 //RTO_MAX in messaging_core.c
+#define BUSY_RETRIES 12 //Re-sends tried while the outbox is busy
+
+#define CHECK(condition) do{\
+    if(!(condition)){\
+      fprintf(stderr,"%s:%d: check failed: %s\n",__FILE__,__LINE__,#condition);\
+      exit(1);\
+    }\
+  }while(0)
+
+//----------LOCAL VARIABLES----------
+static bool countingAllocations = false;//true while the send path is being measured
+static int allocations = 0;//heap allocations made while counting
+static uint8_t outboxBuffer[PEBBLE_DICT_SIZE];//fake AppMessage outbox
+static DictionaryIterator outboxIter;//iterator returned by app_message_outbox_begin
+static AppMessageOutboxSent sentCallback = NULL;//messaging_core's sent handler
+static int32_t sent[MAX_SENT];//sequence numbers in the order they were sent
+static int sentCount = 0;//number of messages sent
+static AppMessageResult sendResult = APP_MSG_OK;//result returned by the fake outbox
+static AppTimerCallback timerCallback = NULL;//callback of the last timer registered
+static uint32_t timerDelay = 0;//timeout of the last timer registered
+
+//----------ALLOCATION COUNTING----------
+//Linked with -Wl,--wrap so every heap call from the tested code lands here
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t count, size_t size);
+void * __real_realloc(void * ptr, size_t size);
+
+void * __wrap_malloc(size_t size){
+  if(countingAllocations) allocations++;
+  return __real_malloc(size);
+}
+
+void * __wrap_calloc(size_t count, size_t size){
+  if(countingAllocations) allocations++;
+  return __real_calloc(count, size);
+}
+
+void * __wrap_realloc(void * ptr, size_t size){
+  if(countingAllocations) allocations++;
+  return __real_realloc(ptr, size);
+}
+
+//----------SDK STAND-INS----------
+void app_log(uint8_t log_level, const char * src_filename, int src_line_number,
+             const char * fmt, ...){}
+
+size_t heap_bytes_free(void){
+  return 100000;
+}
+
+AppTimer * app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void * callback_data){
+  timerCallback = callback;
+  timerDelay = timeout_ms;
+  return NULL;
+}
+
+bool app_timer_reschedule(AppTimer * timer_handle, uint32_t new_timeout_ms){
+  return false;
+}
+
+void app_timer_cancel(AppTimer * timer_handle){}
+
+uint32_t getTimeMs(){
+  return 0;
+}
+
+void debugDictionary(DictionaryIterator * it){}
+
+//Dictionaries use the SDK's layout: a tuple count, then each tuple's
+//key, type, length and value
+#define TUPLE_HEADER_SIZE (sizeof(Tuple))
+
+uint32_t dict_calc_buffer_size(const uint8_t tuple_count, ...){
+  uint32_t size = sizeof(Dictionary);
+  va_list sizes;
+  va_start(sizes, tuple_count);
+  for(int i = 0; i < tuple_count; i++) size += TUPLE_HEADER_SIZE + va_arg(sizes, uint32_t);
+  va_end(sizes);
+  return size;
+}
+
+DictionaryResult dict_write_begin(DictionaryIterator * iter, uint8_t * const buffer, const uint16_t size){
+  if(size < sizeof(Dictionary)) return DICT_NOT_ENOUGH_STORAGE;
+  iter->dictionary = (Dictionary *) buffer;
+  iter->dictionary->count = 0;
+  iter->cursor = iter->dictionary->head;
+  iter->end = buffer + size;
+  return DICT_OK;
+}
+
+DictionaryResult dict_write_data(DictionaryIterator * iter, const uint32_t key,
+                                 const uint8_t * const data, const uint16_t size){
+  uint8_t * value = (uint8_t *) iter->cursor + TUPLE_HEADER_SIZE;
+  if(value + size > (uint8_t *) iter->end) return DICT_NOT_ENOUGH_STORAGE;
+  iter->cursor->key = key;
+  iter->cursor->type = TUPLE_BYTE_ARRAY;
+  iter->cursor->length = size;
+  memcpy(value, data, size);
+  iter->cursor = (Tuple *)(value + size);
+  iter->dictionary->count++;
+  return DICT_OK;
+}
+
+DictionaryResult dict_write_cstring(DictionaryIterator * iter, const uint32_t key, const char * const cstring){
+  Tuple * tuple = iter->cursor;
+  DictionaryResult result = dict_write_data(iter, key, (const uint8_t *) cstring, strlen(cstring) + 1);
+  if(result == DICT_OK) tuple->type = TUPLE_CSTRING;
+  return result;
+}
+
+DictionaryResult dict_write_int(DictionaryIterator * iter, const uint32_t key, const void * integer,
+                                const uint8_t width_bytes, const bool is_signed){
+  Tuple * tuple = iter->cursor;
+  DictionaryResult result = dict_write_data(iter, key, integer, width_bytes);
+  if(result == DICT_OK) tuple->type = is_signed ? TUPLE_INT : TUPLE_UINT;
+  return result;
+}
+
+uint32_t dict_write_end(DictionaryIterator * iter){
+  iter->end = iter->cursor;
+  return (uint8_t *) iter->cursor - (uint8_t *) iter->dictionary;
+}
+
+Tuple * dict_read_begin_from_buffer(DictionaryIterator * iter, const uint8_t * const buffer,
+                                    const uint16_t size){
+  if(size < sizeof(Dictionary) + TUPLE_HEADER_SIZE) return NULL;
+  iter->dictionary = (Dictionary *) buffer;
+  iter->end = buffer + size;
+  iter->cursor = iter->dictionary->head;
+  return iter->dictionary->count > 0 ? iter->cursor : NULL;
+}
+
+Tuple * dict_read_next(DictionaryIterator * iter){
+  iter->cursor = (Tuple *)((uint8_t *) iter->cursor + TUPLE_HEADER_SIZE + iter->cursor->length);
+  if((uint8_t *) iter->cursor + TUPLE_HEADER_SIZE > (uint8_t *) iter->end) return NULL;
+  return iter->cursor;
+}
+
+Tuple * dict_find(const DictionaryIterator * iter, const uint32_t key){
+  DictionaryIterator read = *iter;
+  Tuple * tuple = dict_read_begin_from_buffer(&read, (uint8_t *) iter->dictionary,
+                                              (uint8_t *) iter->end - (uint8_t *) iter->dictionary);
+  for(int i = 0; tuple != NULL && i < read.dictionary->count; i++){
+    if(tuple->key == key) return tuple;
+    tuple = dict_read_next(&read);
+  }
+  return NULL;
+}
+
+AppMessageResult app_message_open(const uint32_t size_inbound, const uint32_t size_outbound){
+  return APP_MSG_OK;
+}
+
+void app_message_deregister_callbacks(void){
+  sentCallback = NULL;
+}
+
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived received_callback){
+  return NULL;
+}
+
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped dropped_callback){
+  return NULL;
+}
+
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent sent_callback){
+  sentCallback = sent_callback;
+  return NULL;
+}
+
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed failed_callback){
+  return NULL;
+}
+
+uint32_t app_message_inbox_size_maximum(void){
+  return 2048;
+}
+
+AppMessageResult app_message_outbox_begin(DictionaryIterator ** iterator){
+  dict_write_begin(&outboxIter, outboxBuffer, sizeof(outboxBuffer));
+  *iterator = &outboxIter;
+  return APP_MSG_OK;
+}
+
+//records the sequence number of each message handed to the fake outbox
+AppMessageResult app_message_outbox_send(void){
+  if(sendResult != APP_MSG_OK) return sendResult;
+  Tuple * sequence = dict_find(&outboxIter, KEY_REQUEST_ID);
+  CHECK(sequence != NULL && sentCount < MAX_SENT);
+  sent[sentCount++] = sequence->value->int32;
+  return APP_MSG_OK;
+}
+
+bool connection_service_peek_pebble_app_connection(void){
+  return true;
+}
+
+void connection_service_subscribe(ConnectionHandlers conn_handlers){}
+
+void connection_service_unsubscribe(void){}
+
+void app_comm_set_sniff_interval(const SniffInterval interval){}
+
+//----------TEST HELPERS----------
+/**
+*Queues a message holding a message code and a sequence number
+*@param priority the queue the message is added to
+*@param sequence the sequence number written to the message
+*@param mergeKey the message's merge key, or MESSAGE_NO_MERGE
+*@return the end_message result
+*/
+static MessageQueueResult queue_message(MessagePriority priority, int32_t sequence, uint32_t mergeKey){
+  DictionaryIterator * iter = begin_message(priority, MESSAGE_CLASS_NONE, mergeKey);
+  if(iter == NULL) return MESSAGE_REJECTED;
+  int8_t code = 1;
+  CHECK(dict_write_int(iter, KEY_MESSAGE_CODE, &code, sizeof(code), true) == DICT_OK);
+  CHECK(dict_write_int(iter, KEY_REQUEST_ID, &sequence, sizeof(sequence), true) == DICT_OK);
+  return end_message();
+}
+
+/**
+*Acknowledges the message in the outbox, so the next one is sent
+*/
+static void acknowledge(){
+  CHECK(sentCallback != NULL);
+  sentCallback(&outboxIter, NULL);
+}
+
+//----------TESTS----------
+int main(){
+  budget_init();
+  open_messaging();
+  countingAllocations = true;
+
+  //steady traffic: each round queues a few messages, then the phone
+  //acknowledges them, so the ring wraps many times
+  int32_t nextId = 0;
+  for(int round = 0; round < ROUNDS; round++){
+    int start = sentCount;
+    int queued = 1 + round % 4;
+    for(int i = 0; i < queued; i++){
+      CHECK(queue_message(MESSAGE_PRIORITY_BACKGROUND, nextId + i, MESSAGE_NO_MERGE) == MESSAGE_QUEUED);
+    }
+    for(int i = 0; i < queued; i++) acknowledge();
+    CHECK(sentCount == start + queued);
+    for(int i = 0; i < queued; i++) CHECK(sent[start + i] == nextId + i);
+    nextId += queued;
+  }
+
+  //a full queue rejects new messages, then drains in order
+  int start = sentCount;
+  int queued = 0;
+  while(queue_message(MESSAGE_PRIORITY_BACKGROUND, nextId + queued, MESSAGE_NO_MERGE) == MESSAGE_QUEUED){
+    queued++;
+  }
+  CHECK(queued > 1);
+  for(int i = 0; i < queued; i++) acknowledge();
+  CHECK(sentCount == start + queued);
+  for(int i = 0; i < queued; i++) CHECK(sent[start + i] == nextId + i);
+  nextId += queued;
+
+  //a message with the same merge key replaces the queued one in place
+  start = sentCount;
+  CHECK(queue_message(MESSAGE_PRIORITY_BACKGROUND, nextId, MESSAGE_NO_MERGE) == MESSAGE_QUEUED);
+  CHECK(queue_message(MESSAGE_PRIORITY_BACKGROUND, nextId + 1, 7) == MESSAGE_QUEUED);
+  CHECK(queue_message(MESSAGE_PRIORITY_BACKGROUND, nextId + 2, 7) == MESSAGE_MERGED);
+  acknowledge();
+  acknowledge();
+  CHECK(sentCount == start + 2 && sent[start] == nextId && sent[start + 1] == nextId + 2);
+  nextId += 3;
+
+  //interactive messages are sent ahead of waiting background messages
+  start = sentCount;
+  CHECK(queue_message(MESSAGE_PRIORITY_BACKGROUND, nextId, MESSAGE_NO_MERGE) == MESSAGE_QUEUED);
+  CHECK(queue_message(MESSAGE_PRIORITY_BACKGROUND, nextId + 1, MESSAGE_NO_MERGE) == MESSAGE_QUEUED);
+  CHECK(queue_message(MESSAGE_PRIORITY_INTERACTIVE, nextId + 2, MESSAGE_NO_MERGE) == MESSAGE_QUEUED);
+  for(int i = 0; i < 3; i++) acknowledge();
+  CHECK(sentCount == start + 3 && sent[start] == nextId);
+  CHECK(sent[start + 1] == nextId + 2 && sent[start + 2] == nextId + 1);
+  nextId += 3;
+
+  //a busy outbox is retried with a doubling delay, up to the limit
+  start = sentCount;
+  sendResult = APP_MSG_BUSY;
+  CHECK(queue_message(MESSAGE_PRIORITY_INTERACTIVE, nextId, MESSAGE_NO_MERGE) == MESSAGE_QUEUED);
+  AppTimerCallback resend = timerCallback;
+  uint32_t delay = timerDelay;
+  CHECK(resend != NULL && delay > 0);
+  for(int i = 0; i < BUSY_RETRIES; i++){
+    resend(NULL);
+    CHECK(timerDelay == (delay * 2 < RESEND_DELAY_LIMIT ? delay * 2 : RESEND_DELAY_LIMIT));
+    delay = timerDelay;
+  }
+  CHECK(delay == RESEND_DELAY_LIMIT && sentCount == start);
+  sendResult = APP_MSG_OK;
+  resend(NULL);
+  acknowledge();
+  CHECK(sentCount == start + 1 && sent[start] == nextId);
+
+  countingAllocations = false;
+  close_messaging();
+  if(allocations != 0){
+    fprintf(stderr,"outbox_test: send path made %d heap allocations\n", allocations);
+    return 1;
+  }
+  printf("outbox_test: %d messages sent without heap allocations\n", sentCount);
+  return 0;
+}
@@ -0,0 +1,148 @@
+/*
+*@File pebble.h
+*The parts of the Pebble SDK used by the messaging code, declared for
+*host builds of the tests.  Types and values match the SDK headers.
+*/
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+//----------PLATFORM----------
+#define PBL_IF_COLOR_ELSE(if_true, if_false) (if_false)
+#define PBL_IF_ROUND_ELSE(if_true, if_false) (if_false)
+
+//----------LOGGING----------
+typedef enum{
+  APP_LOG_LEVEL_ERROR = 1,
+  APP_LOG_LEVEL_WARNING = 50,
+  APP_LOG_LEVEL_INFO = 100,
+  APP_LOG_LEVEL_DEBUG = 200,
+  APP_LOG_LEVEL_DEBUG_VERBOSE = 255
+}AppLogLevel;
+void app_log(uint8_t log_level, const char * src_filename, int src_line_number,
+             const char * fmt, ...);
+#define APP_LOG(level, fmt, ...) app_log(level, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+
+//----------LAYERS----------
+typedef struct TextLayer TextLayer;
+
+//----------MEMORY AND TIMERS----------
+size_t heap_bytes_free(void);
+typedef struct AppTimer AppTimer;
+typedef void (* AppTimerCallback)(void * data);
+AppTimer * app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void * callback_data);
+bool app_timer_reschedule(AppTimer * timer_handle, uint32_t new_timeout_ms);
+void app_timer_cancel(AppTimer * timer_handle);
+
+//----------DICTIONARIES----------
+typedef enum{
+  TUPLE_BYTE_ARRAY = 0,
+  TUPLE_CSTRING = 1,
+  TUPLE_UINT = 2,
+  TUPLE_INT = 3
+}TupleType;
+
+typedef struct __attribute__((__packed__)){
+  uint32_t key;
+  TupleType type:8;
+  uint16_t length;
+  union{
+    uint8_t data[0];
+    char cstring[0];
+    uint8_t uint8;
+    uint16_t uint16;
+    uint32_t uint32;
+    int8_t int8;
+    int16_t int16;
+    int32_t int32;
+  }value[];
+}Tuple;
+
+typedef struct __attribute__((__packed__)){
+  uint8_t count;
+  Tuple head[];
+}Dictionary;
+
+typedef struct{
+  Dictionary * dictionary;
+  const void * end;
+  Tuple * cursor;
+}DictionaryIterator;
+
+typedef enum{
+  DICT_OK = 0,
+  DICT_NOT_ENOUGH_STORAGE = 1 << 1,
+  DICT_INVALID_ARGS = 1 << 2,
+  DICT_INTERNAL_INCONSISTENCY = 1 << 3,
+  DICT_MALLOC_FAILED = 1 << 4
+}DictionaryResult;
+
+uint32_t dict_calc_buffer_size(const uint8_t tuple_count, ...);
+DictionaryResult dict_write_begin(DictionaryIterator * iter, uint8_t * const buffer, const uint16_t size);
+DictionaryResult dict_write_data(DictionaryIterator * iter, const uint32_t key,
+                                 const uint8_t * const data, const uint16_t size);
+DictionaryResult dict_write_cstring(DictionaryIterator * iter, const uint32_t key, const char * const cstring);
+DictionaryResult dict_write_int(DictionaryIterator * iter, const uint32_t key, const void * integer,
+                                const uint8_t width_bytes, const bool is_signed);
+uint32_t dict_write_end(DictionaryIterator * iter);
+Tuple * dict_read_begin_from_buffer(DictionaryIterator * iter, const uint8_t * const buffer,
+                                    const uint16_t size);
+Tuple * dict_read_next(DictionaryIterator * iter);
+Tuple * dict_find(const DictionaryIterator * iter, const uint32_t key);
+
+//----------APP MESSAGE----------
+typedef enum{
+  APP_MSG_OK = 0,
+  APP_MSG_SEND_TIMEOUT = 1 << 1,
+  APP_MSG_SEND_REJECTED = 1 << 2,
+  APP_MSG_NOT_CONNECTED = 1 << 3,
+  APP_MSG_APP_NOT_RUNNING = 1 << 4,
+  APP_MSG_INVALID_ARGS = 1 << 5,
+  APP_MSG_BUSY = 1 << 6,
+  APP_MSG_BUFFER_OVERFLOW = 1 << 7,
+  APP_MSG_ALREADY_RELEASED = 1 << 9,
+  APP_MSG_CALLBACK_ALREADY_REGISTERED = 1 << 10,
+  APP_MSG_CALLBACK_NOT_REGISTERED = 1 << 11,
+  APP_MSG_OUT_OF_MEMORY = 1 << 12,
+  APP_MSG_CLOSED = 1 << 13,
+  APP_MSG_INTERNAL_ERROR = 1 << 14,
+  APP_MSG_INVALID_STATE = 1 << 15
+}AppMessageResult;
+
+typedef void (* AppMessageInboxReceived)(DictionaryIterator * iterator, void * context);
+typedef void (* AppMessageInboxDropped)(AppMessageResult reason, void * context);
+typedef void (* AppMessageOutboxSent)(DictionaryIterator * iterator, void * context);
+typedef void (* AppMessageOutboxFailed)(DictionaryIterator * iterator, AppMessageResult reason,
+                                        void * context);
+
+AppMessageResult app_message_open(const uint32_t size_inbound, const uint32_t size_outbound);
+void app_message_deregister_callbacks(void);
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived received_callback);
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped dropped_callback);
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent sent_callback);
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed failed_callback);
+uint32_t app_message_inbox_size_maximum(void);
+AppMessageResult app_message_outbox_begin(DictionaryIterator ** iterator);
+AppMessageResult app_message_outbox_send(void);
+
+//----------CONNECTION----------
+typedef void (* ConnectionHandler)(bool connected);
+typedef struct{
+  ConnectionHandler pebble_app_connection_handler;
+  ConnectionHandler pebblekit_connection_handler;
+}ConnectionHandlers;
+bool connection_service_peek_pebble_app_connection(void);
+void connection_service_subscribe(ConnectionHandlers conn_handlers);
+void connection_service_unsubscribe(void);
+
+typedef enum{
+  SNIFF_INTERVAL_NORMAL = 0,
+  SNIFF_INTERVAL_REDUCED = 1
+}SniffInterval;
+void app_comm_set_sniff_interval(const SniffInterval interval);